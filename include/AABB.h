@@ -20,6 +20,9 @@ public:
 	void expand(const AABB& b);
 
 	glm::vec3 centroid() const;
+	float surfaceArea() const;
+	int maxExtentAxis() const;
 
-	//bool intersectAABB(const AABB& box, const Ray& r, float& out_near, float& out_far);
+	// Slab intersection. Returns true and writes the entry/exit distances if the ray overlaps the box within [tmin, tmax]
+	bool intersectAABB(const Ray& r, float& out_near, float& out_far) const;
 };
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+
+// Progressive accumulation: two RGBA32F targets used in turn. Each frame reads the running average
+// of earlier frames from one and writes the average including its own samples to the other, so a
+// static view keeps converging at the cost of a single frame's samples. Reset it whenever the camera
+// or the scene changes.
+class AccumulationBuffer
+{
+public:
+    AccumulationBuffer();
+    ~AccumulationBuffer();
+
+    AccumulationBuffer(const AccumulationBuffer&) = delete;
+    AccumulationBuffer& operator=(const AccumulationBuffer&) = delete;
+
+    // (re)allocates both targets when the size changes; returns true if it did, the history is then gone
+    bool resize(int width, int height);
+
+    // drops the history; the next frame starts a new average
+    void reset() { m_SampleCount = 0; }
+
+    // Binds the target of this frame as the framebuffer, the previous average to the given texture unit
+    // (uAccum) and the number of samples in it (uAccumSamples). The shader must be bound.
+    void beginFrame(Shader& shader, int unit) const;
+
+    // Same for a compute pass: binds the previous average to image unit 0 (read only) and this frame's
+    // target to image unit 1 (write only), and sets uAccumSamples. Finish with endFrame() as well.
+    void beginComputeFrame(Shader& shader) const;
+
+    // adds the frame's samples per pixel to the count, makes its target the result and rebinds the
+    // default framebuffer
+    void endFrame(int samples);
+
+    // texture with the latest average, linear radiance
+    GLuint resultTexture() const { return m_Textures[m_Current]; }
+    int sampleCount() const { return m_SampleCount; }
+
+    // copies the latest average to out, width * height colors bottom row first
+    void read(std::vector<glm::vec3>& out) const;
+
+private:
+    GLuint m_Framebuffers[2];
+    GLuint m_Textures[2];
+    int m_Current; // target holding the latest average
+    int m_Width, m_Height;
+    int m_SampleCount;
+
+    void release();
+};
@@ -1,33 +1,125 @@
 #pragma once
 
 #include <vector>
+#include <utility>
 #include <algorithm>
+#include <cstdint>
 #include <glm/glm.hpp>
 
 #include "AABB.h"
 #include "Triangle.h"
 #include "Ray.h"
+#include "ThreadPool.h"
 
+// 32 bytes. Nodes are stored depth-first, so an interior node's left child is always the next node
+// and only the right child needs an index. GPUScene uploads these bytes unchanged.
 class BVHNode {
 public:
     AABB bounds;
-    int left;    // index of left child (-1 if leaf)
-    int right;   // index of right child (-1 if leaf)
-    int start;   // start index into primitive array for leaf
-    int count;   // number of primitives in leaf
+    int offset;  // leaf: first primitive; interior: index of the right child
+    int count;   // leaf: number of primitives; 0 for interior nodes
 
     BVHNode();
+
+    bool isLeaf() const { return count > 0; }
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode is uploaded as two RGBA32F texels");
+
+// how interior nodes choose their split
+enum class BVHSplitMethod {
+    Median, // median centroid on the longest axis
+    SAH,    // binned surface area heuristic
+    Morton, // linear BVH: split sorted Morton codes at their highest differing bit
+    SBVH    // binned SAH plus spatial splits that duplicate straddling triangles (split BVH)
+};
+
+struct BVHBuildSettings {
+    BVHSplitMethod method = BVHSplitMethod::SAH;
+    int maxLeafSize = 8;
+    int sahBins = 16;            // centroid bins per axis
+    float traversalCost = 1.0f;  // SAH cost of visiting an interior node
+    float intersectCost = 1.0f;  // SAH cost of one ray-triangle test
+    int buildThreads = 0;        // 0 = all hardware threads, 1 = single-threaded
+    int parallelThreshold = 4096; // subtrees with fewer primitives are built by one task
+    int mortonBits = 30;         // Morton code length for the linear builder: 30 or 63
+    float maxRefitDegradation = 1.5f; // rebuild once refitted SAH cost exceeds this factor of the built cost
+    float sbvhMaxDuplication = 0.3f;  // SBVH: extra references allowed, as a fraction of the input triangles
+    float sbvhOverlapThreshold = 1e-5f; // SBVH: try spatial splits when object-split children overlap by
+                                        // more than this fraction of the root surface area
+    int treeletPasses = 0;       // treelet restructuring rounds after the build, 0 = off
+    int treeletLeaves = 7;       // leaves per restructured treelet, at most 8
 };
 
 class BVH {
 public:
     std::vector<BVHNode> nodes;
-    std::vector<bvhTri> primitives; // will be reordered during build
+    std::vector<bvhTri> primitives; // will be reordered during build; SBVH may reference a triangle
+                                    // several times, each copy with its clipped bounds
+    int inputPrimitiveCount;    // triangles passed to the last build()
+    BVHBuildSettings settings;
+    float builtSAHCost;         // SAH cost right after the last full build
+    int maxDepth;               // edges from the root to the deepest leaf, set by build() and restore()
+    std::vector<std::pair<int, int>> dirtyNodeRanges; // node ranges [first, last) changed by the last refit
 
     BVH();
 
-    int build_recursive(int start, int end, int maxLeafSize);
-    void build(std::vector<bvhTri> tris, int maxLeafSize = 8);
+    int build_recursive(int start, int end, std::vector<BVHNode>& out);
+    void build(std::vector<bvhTri> tris, const BVHBuildSettings& buildSettings = BVHBuildSettings());
+
+    // takes over a tree built earlier (e.g. read back from a BVHCache file) instead of building
+    void restore(std::vector<BVHNode> builtNodes, std::vector<bvhTri> builtPrimitives, int inputCount,
+        const BVHBuildSettings& buildSettings);
+
+    // expected cost of a random ray through the tree, relative to the root surface area
+    float computeSAHCost() const;
+
+    // Entries a depth-first traversal that pushes both children of every visited node can hold at
+    // once: one pending sibling per level above the current node plus its two children.
+    int traversalStackSize() const { return maxDepth + 1; }
+
+    // appends the parent of every node in node order, -1 for the root
+    void appendParents(std::vector<int>& out) const;
+
+    // Recomputes primitive and node bounds bottom-up after vertices moved without changing topology.
+    // Nodes whose bounds changed are recorded in dirtyNodeRanges.
+    void refit();
+
+    // refitted SAH cost relative to the cost right after the last build
+    float refitDegradation() const;
+    bool needsRebuild() const;
+
+    // builds again from the current primitives with the current settings; SBVH duplicates
+    // (same bvhTri::id) are collapsed back to one full triangle first
+    void rebuild();
+
+    // closest hit within [r.tmin, r.tmax]; out_triIdx indexes the reordered primitives
+    bool intersectNearest(const Ray& r, float& out_t, int& out_triIdx, float& out_u, float& out_v) const;
+
+private:
+    int computeMaxDepth() const;
+
+    // linear builder: sorts primitives by Morton code, then emits the hierarchy top-down
+    void build_lbvh();
+    int emit_lbvh(const std::vector<uint64_t>& codes, int start, int end, std::vector<BVHNode>& out);
+
+    // split BVH: works on per-node reference lists, appends the leaf references to primitives
+    void build_sbvh();
+    int build_sbvh_recursive(std::vector<bvhTri>& refs, int& duplicationBudget, float rootArea);
+
+    // Karras & Aila treelet restructuring: reshapes the treelet below every interior node to its
+    // SAH-optimal topology, bottom-up, then restores depth-first node order. Subtrees may collapse
+    // into leaves of up to maxLeafSize primitives, so primitives are reordered too.
+    void optimizeTreelets();
+
+    // builds [start, end) into its own node arena, forking the two halves onto the pool
+    void build_parallel(int start, int end, std::vector<BVHNode>& out, ThreadPool& pool);
+
+    // computes the bounds of [start, end), reorders it and returns the split index, or -1 to make a leaf
+    int splitRange(int start, int end, AABB& bounds);
+
+    // reorder primitives [start, end) and return the split index, or -1 to make a leaf
+    int partitionMedian(int start, int end, const AABB& centroidBounds);
+    int partitionSAH(int start, int end, const AABB& bounds, const AABB& centroidBounds);
 
-    /*bool intersectNearest(const Ray& r, float& out_t, int& out_triIdx, float& out_u, float& out_v) const;*/
 };
\ No newline at end of file
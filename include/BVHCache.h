@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "BVH.h"
+#include "GPUScene.h"
+#include "Scene.h"
+
+// 64-bit FNV-1a over everything that determines a built scene
+class ContentHash {
+public:
+    ContentHash();
+
+    void add(const void* data, size_t bytes);
+    template <typename T>
+    void addValue(const T& v) { add(&v, sizeof(T)); }
+    void addString(const std::string& s);
+    // hashes the file's bytes; returns false (and hashes only the path) if it cannot be read
+    bool addFile(const std::string& path);
+
+    uint64_t value() const { return m_State; }
+
+private:
+    uint64_t m_State;
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    const unsigned char* data() const { return m_Data; }
+    size_t size() const { return m_Size; }
+
+private:
+    const unsigned char* m_Data;
+    size_t m_Size;
+#ifdef _WIN32
+    void* m_File;
+    void* m_Mapping;
+#else
+    int m_File;
+#endif
+};
+
+// Binary cache of a built scene: the bottom-level BVHs with their primitives, the instances, the
+// materials, and the packed triangle and node arrays exactly as GPUScene uploads them. A file is only used when its key
+// matches the hash of the scene description and build settings it was written for.
+//
+// Layout: header, section table, then each section 16-byte aligned.
+class BVHCache {
+public:
+    BVHCache();
+
+    // key over model file contents, materials, transforms, build settings and the cache format
+    static uint64_t sceneKey(const std::vector<SceneModelDesc>& models, const BVHBuildSettings& settings);
+
+    static bool save(const std::string& path, uint64_t key, const Scene& scene, const GPUScene& gpuScene);
+
+    // maps the file and checks its key and section table; false if missing, stale or damaged
+    bool open(const std::string& path, uint64_t key);
+    void close();
+
+    // rebuilds the CPU scene from the file (bottom-level trees are copied, the top level is rebuilt)
+    void restore(Scene& scene) const;
+
+    // uploads the packed arrays straight from the mapping; scene must come from restore()
+    void upload(const Scene& scene, GPUScene& gpuScene) const;
+
+private:
+    MappedFile m_File;
+
+    const void* section(uint32_t id, size_t& bytes) const;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "LightBVH.h"
+#include "LightSampler.h"
+#include "Scene.h"
+#include "ThreadPool.h"
+#include "TileScheduler.h"
+
+struct CpuRenderSettings {
+    int width = 1400;
+    int height = 1200;
+    int spp = 20;        // samples per pixel
+    int maxDepth = 8;    // max bounces
+    int frame = 0;       // RNG decorrelation, same role as uFrame
+    int tileSize = 16;   // pixels per tile side
+    bool primaryPackets = true; // trace camera rays of 8 neighbouring pixels as one packet
+    bool lightTree = true;      // pick lights from the light BVH instead of by power alone
+};
+
+// Headless path tracer running the integrator of raytracing_fragment.glsl on the CPU: same hash RNG
+// and seeds, camera rays, next event estimation, cosine-weighted bounces and Russian roulette, so a
+// frame matches the GPU one up to float rounding. Tiles of the image are traced on a thread pool in
+// Hilbert order with work stealing (TileScheduler); no window or GL context is needed.
+// Camera rays are coherent and traced as 8-ray packets; every bounce after the first hit continues
+// one ray at a time.
+class CpuRenderer
+{
+public:
+    // numThreads <= 0 uses all hardware threads
+    explicit CpuRenderer(int numThreads = 0);
+
+    // Renders one frame. outRadiance receives width * height linear colors averaged over the samples,
+    // before tone mapping, bottom row first like gl_FragCoord.
+    void render(const Scene& scene, const glm::vec3& camPos, const glm::mat4& invViewProj,
+                const CpuRenderSettings& settings, std::vector<glm::vec3>& outRadiance);
+
+    // Reinhard tone mapping and 1/2.2 gamma, as display_fragment.glsl writes to the window
+    static glm::vec3 toneMap(const glm::vec3& radiance);
+
+    int threadCount() const { return m_Pool.size(); }
+
+    // per-thread busy/idle time of the last render()
+    const std::vector<TileWorkerStats>& tileStats() const { return m_TileStats; }
+
+private:
+    // per-pixel state of the shader's hash RNG
+    struct Rng {
+        uint32_t x, y, z;
+        float next();
+    };
+
+    ThreadPool m_Pool;
+    LightSampler m_Lights;
+    LightBVH m_LightTree;
+    std::vector<TileWorkerStats> m_TileStats;
+
+    // pixels [x0, x1) of row y, at most 8, written to out
+    void traceSpan(const Scene& scene, int x0, int x1, int y, const glm::vec3& camPos, const glm::mat4& invViewProj,
+                   const CpuRenderSettings& settings, glm::vec3* out) const;
+    // jittered camera ray through pixel (x, y)
+    static Ray cameraRay(Rng& rng, int x, int y, const glm::vec3& camPos, const glm::mat4& invViewProj,
+                         const CpuRenderSettings& settings);
+    // radiance along one camera path; primaryHit, if given, is the already traced first intersection
+    // of ray (instance < 0 for a miss)
+    glm::vec3 tracePath(const Scene& scene, Ray ray, const SceneHit* primaryHit, Rng& rng,
+                        const CpuRenderSettings& settings) const;
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "AABB.h"
+#include "BVH.h"
+#include "LightBVH.h"
+#include "LightSampler.h"
+#include "Scene.h"
+#include "Shader.h"
+#include "Triangle.h"
+
+// Scene packed into the buffer textures read by raytracing_common.glsl
+//   uTriangles: 3 texels per triangle (v0 with the material index, both edges), the object-space
+//               triangles of every geometry back to back
+//   uMaterials: 2 texels per scene material (albedo, emission)
+//   uBVHNodes:  2 texels per node (BVHNode as is), every bottom-level tree back to back; child and
+//               primitive indices stay relative to their tree and are rebased with the instance's
+//               root node and first triangle
+//   uTLASNodes: 2 texels per top-level node, leaves index uInstances
+//   uInstances: 7 texels per instance, in top-level primitive order
+//   uLights:    4 texels per emissive triangle, in world space with its alias table entry
+//   uLightTree: 3 texels per light BVH node (LightBVHNode as is)
+//   uBVHParents, uTLASParents: 1 R32I texel per node, the parent in the layout of uBVHNodes and
+//               uTLASNodes; only bound when the trees are too deep for a traversal stack
+// With useStorageBuffers the same buffers holding triangles, bottom-level nodes, top-level nodes and
+// instances are bound as std430 storage buffers 4-7 instead; materials and lights are read once per
+// bounce and stay texture buffers either way.
+class GPUScene
+{
+public:
+    std::vector<Triangle> triangles;
+    std::vector<glm::vec4> materialTexels;
+    std::vector<BVHNode> nodes;
+    std::vector<BVHNode> tlasNodes;
+    std::vector<glm::vec4> instanceTexels;
+    LightSampler lights;
+    std::vector<glm::vec4> lightTexels;
+    LightBVH lightTree;
+    bool useLightTree;              // NEE picks lights from lightTree rather than by power alone
+    bool useStorageBuffers;         // bind as SSBOs; shaders must be built with shaderDefines() to match
+    std::vector<int> nodeOffsets;   // first node of each geometry
+    std::vector<int> primOffsets;   // first triangle of each geometry
+    std::vector<int> nodeParents;   // BVH::appendParents of every geometry back to back
+    std::vector<int> tlasParents;
+    int instanceCount;
+    AABB bounds;
+    int traversalStackSize;         // entries the deepest uploaded tree needs (BVH::traversalStackSize)
+    int maxStackSize;               // stack budget of the tracing shaders; deeper scenes trace stackless
+
+    GPUScene();
+    ~GPUScene();
+
+    GPUScene(const GPUScene&) = delete;
+    GPUScene& operator=(const GPUScene&) = delete;
+
+    // packs and uploads every buffer
+    void upload(const Scene& scene);
+
+    // Uploads bottom-level triangles and nodes packed earlier for this scene (e.g. mapped from a
+    // BVHCache file) as they are, then packs the materials and the top level. The triangles and nodes
+    // mirrors stay empty.
+    void upload(const Scene& scene, const Triangle* packedTriangles, const BVHNode* packedNodes);
+
+    // repacks and uploads the top-level nodes, instances and lights only, e.g. after moving an instance
+    void uploadTopLevel(const Scene& scene);
+
+    // uploads the triangles and changed node ranges of a geometry refitted in place
+    void uploadRefit(const Scene& scene, int geometry);
+
+    // binds the buffer textures to units 0-5 and 7 (or storage buffers 4-7 and texture units 4, 5 and
+    // 7), the parent links to units 8 and 9 when stackless, and sets the scene uniforms
+    void bind(Shader& shader) const;
+
+    // true if traversalStackSize exceeds the budget and the shaders walk parent links instead
+    bool stackless() const { return traversalStackSize > maxStackSize; }
+
+    // true if the context can read the scene from storage buffers (GL 4.3)
+    static bool storageBuffersSupported();
+
+    // Preprocessor lines for the tracing shaders matching how bind() provides the scene: the storage
+    // buffer switch, and BVH_STACK_SIZE rounded up to a multiple of 8 within the budget (so small depth
+    // changes after a rebuild keep the compiled shaders) or BVH_STACKLESS
+    std::string shaderDefines() const;
+
+private:
+    GLuint m_TriBuffer, m_TriTex;
+    GLuint m_MaterialBuffer, m_MaterialTex;
+    GLuint m_NodeBuffer, m_NodeTex;
+    GLuint m_TLASBuffer, m_TLASTex;
+    GLuint m_InstanceBuffer, m_InstanceTex;
+    GLuint m_LightBuffer, m_LightTex;
+    GLuint m_LightTreeBuffer, m_LightTreeTex;
+    GLuint m_ParentBuffer, m_ParentTex;
+    GLuint m_TLASParentBuffer, m_TLASParentTex;
+    int m_BLASStackSize;
+
+    void uploadMaterials(const Scene& scene);
+    void uploadParents(const Scene& scene);
+    void packTopLevel(const Scene& scene);
+    void computeOffsets(const Scene& scene);
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Image writers for the headless renderer. Pixels are width * height colors, bottom row first
+// (gl_FragCoord order). Both return false if the file cannot be written.
+
+// 8-bit binary PPM (P6); colors are clamped to [0, 1] and should already be tone mapped
+bool WritePPM(const std::string& path, int width, int height, const std::vector<glm::vec3>& pixels);
+
+// 32-bit float PFM, little endian; keeps linear HDR radiance as is
+bool WritePFM(const std::string& path, int width, int height, const std::vector<glm::vec3>& pixels);
+
+// 8-bit RGB PNG, clamped like WritePPM; the image data is stored without compression
+bool WritePNG(const std::string& path, int width, int height, const std::vector<glm::vec3>& pixels);
+
+// Uncompressed scanline OpenEXR with 32-bit float R, G, B channels; keeps linear HDR radiance as is
+bool WriteEXR(const std::string& path, int width, int height, const std::vector<glm::vec3>& pixels);
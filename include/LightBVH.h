@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "AABB.h"
+#include "LightSampler.h"
+
+// 48 bytes, uploaded as 3 texels: bmin + power, bmax + cone angle, cone axis + offset
+struct LightBVHNode {
+    glm::vec3 bmin;
+    float power;     // summed power of the lights below
+    glm::vec3 bmax;
+    float thetaO;    // every emitter normal lies within this angle (radians) of axis
+    glm::vec3 axis;
+    int offset;      // interior: right child (left child is the next node); leaf: -(light index + 1)
+
+    bool isLeaf() const { return offset < 0; }
+    int light() const { return -offset - 1; }
+};
+
+// BVH over the emissive triangles of a LightSampler, one light per leaf, for picking lights by their
+// estimated contribution at a shading point. Sampling walks from the root and picks each child in
+// proportion to an importance bound (power, distance, emitter normal cone and the cosine at the
+// receiver), so nearby lights facing the point are chosen far more often than distant or
+// back-facing ones. The bound is conservative: a light that can light the point is never given
+// probability zero.
+class LightBVH {
+public:
+    std::vector<LightBVHNode> nodes; // depth-first, node 0 is the root
+
+    LightBVH();
+
+    void build(const LightSampler& sampler);
+
+    // picks a light for the shading point p with normal n from one uniform number; returns the light
+    // index into sampler.lights with its selection probability, or -1 if no light can reach p
+    int sample(const glm::vec3& p, const glm::vec3& n, float u, float& pmf) const;
+
+    // upper bound of the light a node can send to p, up to a common factor
+    static float importance(const LightBVHNode& node, const glm::vec3& p, const glm::vec3& n);
+
+private:
+    int buildRecursive(const LightSampler& sampler, std::vector<int>& order, int first, int last);
+};
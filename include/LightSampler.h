@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Scene.h"
+
+// One emissive triangle in world space
+struct EmissiveTriangle {
+    glm::vec3 v0, v1, v2;
+    glm::vec3 emission;
+    float area;
+};
+
+// Every emissive triangle of a scene with an alias table over their power (luminance of the emission
+// times area), so picking a light costs O(1) however many there are. Built on the host for both the
+// CPU renderer and GPUScene; rebuild it whenever an instance with emitters moves.
+class LightSampler {
+public:
+    std::vector<EmissiveTriangle> lights;
+    std::vector<float> threshold;   // alias table: keep light i if the fraction of u * count is below this
+    std::vector<int> alias;         // otherwise take this one
+    std::vector<float> probability; // chance of picking each light
+
+    LightSampler();
+
+    // world-space emitters of every instance; SBVH references to the same triangle count once
+    void build(const Scene& scene);
+
+    // picks a light from one uniform number in [0, 1); -1 if there are none
+    int sample(float u) const;
+
+    int count() const { return static_cast<int>(lights.size()); }
+
+    // luminance of the emission times area
+    static float power(const EmissiveTriangle& e);
+};
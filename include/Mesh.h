@@ -18,10 +18,10 @@ public:
     // mesh Data
     std::vector<Vertex>       vertices;
     std::vector<unsigned int> indices;
-    unsigned int VAO;
+    unsigned int VAO; // 0 if the mesh was not uploaded
 
-    // constructor
-    Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices);
+    // constructor; uploadToGPU = false keeps the data on the CPU only and needs no GL context
+    Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, bool uploadToGPU = true);
 
     // render the mesh
     void Draw(Shader& shader);
@@ -17,8 +17,9 @@ public:
     // model data 
     vector<Mesh>  meshes;
 
-    // constructor, expects a filepath to a 3D model.
-    Model(string const& path);
+    // constructor, expects a filepath to a 3D model. uploadToGPU = false only loads the meshes into
+    // memory, without creating any GL objects, so no context is needed.
+    Model(string const& path, bool uploadToGPU = true);
 
     // draws the model, and thus all its meshes
     void Draw(Shader& shader);
@@ -27,6 +28,7 @@ public:
 	int getTriangles() const;
 
 private:
+    bool m_UploadToGPU;
 
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
     void loadModel(string const& path);
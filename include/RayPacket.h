@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Ray.h"
+#include "Scene.h"
+
+// Eight rays traced together, stored SoA so each field loads as one AVX register.
+// Lanes are independent rays; tmax shrinks as closer hits are found.
+struct alignas(32) RayPacket8 {
+    float ox[8], oy[8], oz[8];
+    float dx[8], dy[8], dz[8];
+    float tmin[8], tmax[8];
+
+    RayPacket8();
+
+    void set(int lane, const Ray& r);
+};
+
+// Closest hit of every lane in `active` (bit i = lane i), walking the top-level and the binary
+// bottom-level BVH nodes once for the whole packet: each node box is slab-tested against all lanes at
+// once and each leaf triangle with a masked Möller–Trumbore. Returns the lanes that hit, with
+// hits[lane] and packet.tmax[lane] written for those; the result per lane is the one
+// Scene::intersectNearest gives. Pays off for coherent rays (camera rays of neighbouring pixels);
+// incoherent rays are better traced one by one. Without AVX the lanes are traced one by one.
+int IntersectPacket(const Scene& scene, RayPacket8& packet, int active, SceneHit hits[8]);
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "AABB.h"
+#include "BVH.h"
+#include "Ray.h"
+#include "Triangle.h"
+#include "WideBVH.h"
+
+// One placement of a bottom-level BVH in the world
+struct Instance {
+    int geometry;             // index into Scene::geometries
+    glm::mat4 objectToWorld;
+    glm::mat4 worldToObject;
+    AABB worldBounds;
+};
+
+// Diffuse surface shared by every triangle whose bvhTri::material refers to it
+struct Material {
+    glm::vec3 albedo;
+    glm::vec3 emission;
+
+    bool isEmissive() const { return glm::max(emission.r, glm::max(emission.g, emission.b)) > 0.0f; }
+};
+
+// One model file placed in the world with a single material, as listed in a scene description
+struct SceneModelDesc {
+    std::string path;
+    glm::vec3 albedo;
+    glm::vec3 emission;
+    glm::mat4 objectToWorld;
+};
+
+struct SceneHit {
+    float t;
+    float u, v;
+    int instance;  // index into Scene::instances
+    int prim;      // index into the instance's geometry primitives
+};
+
+// Two-level acceleration structure: one BVH per unique mesh, built in object space,
+// and a small top-level BVH over the world bounds of its instances.
+class Scene {
+public:
+    std::vector<BVH> geometries;
+    std::vector<BVH8> wideGeometries; // 8-wide collapse of each geometry, used by intersectNearest
+    std::vector<Instance> instances;
+    std::vector<Material> materials;  // indexed by bvhTri::material
+    // top-level tree; each primitive is a proxy spanning one instance's world bounds, bvhTri::id = instance index
+    BVH tlas;
+
+    Scene();
+
+    // builds a bottom-level BVH over object-space triangles, returns its geometry index
+    int addGeometry(std::vector<bvhTri> tris, const BVHBuildSettings& settings = BVHBuildSettings());
+    // adds an already built bottom-level BVH
+    int addGeometry(BVH blas);
+    int addInstance(int geometry, const glm::mat4& objectToWorld);
+    // index of the material with this albedo and emission, added if the scene has none yet
+    int addMaterial(const glm::vec3& albedo, const glm::vec3& emission);
+    void setTransform(int instance, const glm::mat4& objectToWorld);
+
+    // rebuilds the top-level BVH, needed after adding instances or changing transforms
+    void buildTopLevel();
+
+    // refits a geometry after its vertices moved (rebuilding it when the refit degraded too far);
+    // returns true if it was rebuilt. Call buildTopLevel() afterwards.
+    bool refitGeometry(int geometry);
+
+    int triangleCount() const;   // unique triangles over all geometries
+    int referenceCount() const;  // leaf references over all geometries, more than triangleCount() with SBVH
+    int maxDepth() const;        // BVH::maxDepth of the deepest tree, bottom- or top-level
+    AABB bounds() const;
+
+    bool intersectNearest(const Ray& r, SceneHit& hit) const;
+    // any hit within (r.tmin, r.tmax), stops at the first one; for shadow rays
+    bool occluded(const Ray& r) const;
+
+private:
+    void updateWorldBounds(Instance& inst) const;
+};
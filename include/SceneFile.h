@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Scene.h"
+
+// Scene description read from a text file, one statement per line, '#' starts a comment:
+//
+//   camera x y z [yaw pitch [fov]]                  position, Euler angles and vertical fov in degrees
+//   translate x y z | rotate degrees x y z | scale s | scale x y z
+//                                                   appended to the current transform, as glm::translate etc.
+//   identity                                        resets the current transform
+//   model path [albedo r g b] [emission r g b]      instanced with the current transform
+//
+// Relative model paths are resolved against the directory of the scene file.
+struct SceneFile {
+    std::vector<SceneModelDesc> models;
+    bool hasCamera = false;
+    glm::vec3 cameraPosition = glm::vec3(0.0f);
+    float cameraYaw = -90.0f;
+    float cameraPitch = 0.0f;
+    float cameraFov = 45.0f;
+};
+
+// parses path into out; prints the first error with its line number and returns false on failure
+bool LoadSceneFile(const std::string& path, SceneFile& out);
@@ -11,15 +11,24 @@ private:
 	unsigned int m_RendererID;
 	std::string m_VertexFilePath;
 	std::string m_FragmentFilePath;
+	std::string m_ComputeFilePath;
 	// Saving the uniform location
 	std::unordered_map<std::string, int> m_UniformLocationCache;
 public:
-	Shader(const std::string& m_VertexFilePath, const std::string& m_FragmentFilePath);
+	// defines: preprocessor lines placed right after the #version line of every stage, e.g.
+	// GPUScene::shaderDefines()
+	Shader(const std::string& m_VertexFilePath, const std::string& m_FragmentFilePath, const std::string& defines = "");
+	// single-stage program; GL_COMPUTE_SHADER (GL 4.3) is the only such stage
+	Shader(GLenum shaderType, const std::string& filePath, const std::string& defines = "");
 	~Shader();
 
+	// false if the program could not be built
+	bool IsValid() const { return m_RendererID != 0; }
+
 	void BindShader() const;
 	void UnBindShader() const;
 
+	// Reads a shader file and splices in every line `#include "file"`, the path relative to the including file
 	std::string ReadShaderSourceFromFile(const std::string& filePath);
 	void SetUniform1i(const std::string& name, int value);
 	void SetUniform1f(const std::string& name, float value);
@@ -36,5 +45,7 @@ private:
 
 	unsigned int CompileShader(GLenum shaderType, const std::string& shaderSource);
 	unsigned int CreateShader(const std::string& vertexShaderSource, const std::string& fragmentShaderSource);
+	unsigned int CreateComputeShader(const std::string& computeShaderSource);
+	static std::string InsertDefines(const std::string& source, const std::string& defines);
 
 };
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool. Every worker owns a deque: it pops its own newest task
+// (depth-first, cache friendly) and steals the oldest task of another worker when idle.
+class ThreadPool
+{
+public:
+	// numThreads <= 0 uses all hardware threads
+	explicit ThreadPool(int numThreads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int size() const;
+
+	// queues a task; from a worker it goes to that worker's own deque
+	void submit(std::function<void()> task);
+
+	// runs one queued task on the calling thread, returns false if nothing was queued
+	bool runPendingTask();
+
+	// index of the calling worker in this pool, -1 if the caller is not one of its workers
+	int currentWorker() const;
+
+	// calls fn(i) for every i in [begin, end), splitting the range into chunks of grainSize
+	void parallelFor(int begin, int end, int grainSize, const std::function<void(int)>& fn);
+
+private:
+	struct WorkQueue {
+		std::deque<std::function<void()>> tasks;
+		std::mutex mutex;
+	};
+
+	std::vector<std::unique_ptr<WorkQueue>> m_Queues;
+	std::vector<std::thread> m_Threads;
+	std::atomic<int> m_Pending;
+	std::atomic<unsigned int> m_NextQueue;
+	std::mutex m_WakeMutex;
+	std::condition_variable m_Wake;
+	bool m_Stop;
+
+	void workerLoop(int index);
+	bool popTask(int index, std::function<void()>& task);
+};
+
+// Fork/join helper: wait() keeps executing queued tasks until every task run() through
+// this group has finished, so nested groups never block a worker.
+class TaskGroup
+{
+public:
+	explicit TaskGroup(ThreadPool& pool);
+	~TaskGroup();
+
+	void run(std::function<void()> task);
+	void wait();
+
+private:
+	ThreadPool& m_Pool;
+	std::atomic<int> m_Outstanding;
+};
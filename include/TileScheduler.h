@@ -0,0 +1,52 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// Pixel rectangle [x0, x1) x [y0, y1)
+struct Tile {
+    int x0, y0;
+    int x1, y1;
+};
+
+// What one worker of the last run() did
+struct TileWorkerStats {
+    double busyMs = 0.0;  // time spent in the tile callback
+    double idleMs = 0.0;  // rest of the run: starting late, looking for work, waiting for the others
+    int tiles = 0;        // tiles rendered
+    int stolen = 0;       // of those, tiles taken from another worker's deque
+};
+
+// Hands out the tiles of an image in Hilbert-curve order, so consecutive tiles are neighbours and
+// share most of the BVH nodes and triangles they touch. Every worker starts with one contiguous run
+// of the curve in its own deque and takes tiles from the front; a worker that runs dry steals from
+// the back of another deque, which is the part of the image farthest from where its owner is working.
+class TileScheduler {
+public:
+    TileScheduler(int width, int height, int tileSize);
+
+    const std::vector<Tile>& tiles() const { return m_Tiles; } // in Hilbert order
+
+    // calls fn(tile) once for every tile, using every thread of the pool; returns when all are done
+    void run(ThreadPool& pool, const std::function<void(const Tile&)>& fn);
+
+    // one entry per worker of the last run()
+    const std::vector<TileWorkerStats>& stats() const { return m_Stats; }
+
+private:
+    struct TileQueue {
+        std::deque<int> tiles;
+        std::mutex mutex;
+    };
+
+    std::vector<Tile> m_Tiles;
+    std::vector<std::unique_ptr<TileQueue>> m_Queues;
+    std::vector<TileWorkerStats> m_Stats;
+
+    bool popTile(int worker, int& tile, bool& stolen);
+};
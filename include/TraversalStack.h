@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+
+// Stack of a depth-first BVH traversal with room for capacity entries, which the tree's depth bounds
+// (BVH::traversalStackSize). Up to N entries live in the object itself; a deeper tree takes heap
+// storage for that one traversal instead of overrunning a fixed array.
+template <typename T, int N>
+class TraversalStack {
+public:
+    explicit TraversalStack(int capacity)
+        : m_Data(m_Inline) {
+        if (capacity > N) {
+            m_Heap.resize(capacity);
+            m_Data = m_Heap.data();
+        }
+    }
+
+    TraversalStack(const TraversalStack&) = delete;
+    TraversalStack& operator=(const TraversalStack&) = delete;
+
+    T& operator[](int i) { return m_Data[i]; }
+
+private:
+    T m_Inline[N];
+    std::vector<T> m_Heap;
+    T* m_Data;
+};
@@ -7,18 +7,21 @@
 #include "Ray.h"
 #include "AABB.h"
 
-// GPU-packing triangle (5 vec4 per tri expected in shader)
+// GPU-packing triangle for intersection tests: the first vertex and both edges from it, computed once
+// at upload instead of for every ray-triangle test. v0.w carries the material index (integer bits),
+// the other w are unused.
 class Triangle {
 public:
-    glm::vec4 v0, v1, v2;
-    glm::vec4 albedo;
-    glm::vec4 emission;
+    glm::vec4 v0;
+    glm::vec4 e1; // v1 - v0
+    glm::vec4 e2; // v2 - v0
 
     Triangle();
-    Triangle(const glm::vec4& _v0, const glm::vec4& _v1, const glm::vec4& _v2,
-        const glm::vec4& _albedo, const glm::vec4& _emission);
+    Triangle(const glm::vec3& _v0, const glm::vec3& _v1, const glm::vec3& _v2, int material);
 };
 
+static_assert(sizeof(Triangle) == 48, "Triangle is uploaded as three RGBA32F texels or one std430 PackedTriangle");
+
 // CPU triangle used for BVH
 class bvhTri {
 public:
@@ -26,13 +29,14 @@ public:
     int id; // optional: original index
     AABB bounds;
     glm::vec3 centroid;
-    glm::vec3 albedo;
-    glm::vec3 emission;
+    int material; // index into Scene::materials
 
     bvhTri();
-    bvhTri(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, int _id = 0,
-        const glm::vec3& alb = glm::vec3(0.8f), const glm::vec3& emi = glm::vec3(0.0f));
+    bvhTri(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, int _id = 0, int _material = 0);
+
+    // recompute bounds and centroid after the vertices moved
+    void updateBounds();
 
     // Möller–Trumbore
-    // static bool intersectTriangle(const Ray& r, const bvhTri& tri, float& t, float& u, float& v);
+    static bool intersectTriangle(const Ray& r, const bvhTri& tri, float& t, float& u, float& v);
 };
\ No newline at end of file
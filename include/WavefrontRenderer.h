@@ -0,0 +1,87 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "AccumulationBuffer.h"
+#include "GPUScene.h"
+#include "Shader.h"
+
+enum class WavefrontStage { Generate, Extend, Shade, Shadow, Accumulate, Count };
+
+// GPU time of each kernel summed over the last timed render(), in milliseconds
+struct WavefrontStageTimes {
+    double ms[static_cast<int>(WavefrontStage::Count)] = {};
+
+    double total() const;
+    static const char* name(WavefrontStage stage);
+};
+
+// Wavefront path tracer on GL 4.3 compute shaders. Runs the integrator of raytracing_fragment.glsl
+// split into small kernels over a path state buffer with one path per pixel:
+//   generate   camera rays, queues the paths that enter the scene bounds
+//   extend     closest hit of every queued path
+//   shade      emission, a shadow ray toward a sampled light, diffuse bounce and Russian roulette;
+//              surviving paths are appended to the next queue
+//   shadow     any-hit test of the shadow rays, adds the light of the visible ones
+//   accumulate averages the samples and folds them into the AccumulationBuffer
+// Queues are compacted with atomic counters and every queue kernel is launched with
+// glDispatchComputeIndirect on group counts the kernels maintain themselves, so the host issues one
+// fixed sequence per sample and depth and never waits on the GPU. Terminated paths cost nothing in
+// later bounces, unlike the fragment shader where a pixel keeps its thread to the end.
+class WavefrontRenderer
+{
+public:
+    WavefrontRenderer();
+    ~WavefrontRenderer();
+
+    WavefrontRenderer(const WavefrontRenderer&) = delete;
+    WavefrontRenderer& operator=(const WavefrontRenderer&) = delete;
+
+    // true if the current context has compute shaders (GL 4.3)
+    static bool supported();
+
+    // compiles the kernels with the given preprocessor lines (GPUScene::shaderDefines); false if one of
+    // them fails
+    bool init(const std::string& defines);
+
+    // One frame of spp samples per pixel at width x height, folded into accumulation like TraceFrame
+    // does with the fragment shader. The RNG is seeded as there, so both converge to the same image.
+    void render(const GPUScene& scene, AccumulationBuffer& accumulation, const glm::vec3& camPos, const glm::mat4& invViewProj,
+                int width, int height, int spp, int maxDepth, int frame);
+
+    // Times every dispatch with timestamp queries; render() then waits for the GPU at its end
+    void setTiming(bool enabled) { m_Timing = enabled; }
+    const WavefrontStageTimes& stageTimes() const { return m_Times; }
+
+private:
+    std::unique_ptr<Shader> m_Stages[static_cast<int>(WavefrontStage::Count)];
+    GLuint m_PathBuffer;
+    GLuint m_QueueBuffer;
+    GLuint m_ShadowBuffer;
+    GLuint m_CounterBuffer; // queue lengths and indirect dispatch arguments
+    int m_PathCount;        // paths the buffers hold
+
+    bool m_Timing;
+    std::vector<GLuint> m_Queries;        // timestamp pairs around dispatches
+    std::vector<WavefrontStage> m_QueryStages;
+    size_t m_QueriesUsed;                 // pairs issued this frame
+    WavefrontStageTimes m_Times;
+
+    Shader& stage(WavefrontStage s) { return *m_Stages[static_cast<int>(s)]; }
+    // (re)allocates the path, queue and shadow ray buffers when the pixel count changes
+    void resize(int pathCount);
+    void release();
+    // empties queue 0 or 1
+    void resetQueue(int queue);
+    void resetShadowRays();
+    void dispatch(WavefrontStage s, GLuint groups);
+    // group count read from the counter buffer at offset
+    void dispatchIndirect(WavefrontStage s, GLintptr offset);
+    void beginTimer(WavefrontStage s);
+    void endTimer();
+    void collectTimes();
+};
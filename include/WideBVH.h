@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "BVH.h"
+#include "Ray.h"
+
+// N-wide node with its child boxes stored SoA, so one SIMD slab test covers every child.
+// Unused slots have an inverted (+inf, -inf) box and never hit.
+template <int N>
+struct alignas(N * 4) WideBVHNode {
+    float bminX[N], bminY[N], bminZ[N];
+    float bmaxX[N], bmaxY[N], bmaxZ[N];
+    int child[N];  // interior child: wide node index; leaf child: first of its triangle groups
+    int count[N];  // 0 = interior child, > 0 = leaf with that many triangles, -1 = unused slot
+};
+
+// Up to N triangles of one leaf, SoA with precomputed edges so one SIMD Möller–Trumbore tests them all.
+// Unused lanes have zero edges, which the determinant test rejects.
+template <int N>
+struct alignas(N * 4) TriangleGroup {
+    float v0x[N], v0y[N], v0z[N];
+    float e1x[N], e1y[N], e1z[N];  // v1 - v0
+    float e2x[N], e2y[N], e2z[N];  // v2 - v0
+    int prim[N];                   // index into the source BVH's primitives, -1 = unused lane
+};
+
+// Collapse of a binary BVH into an N-wide tree (N = 4 or 8). Each leaf's triangles are copied into
+// ceil(count / N) TriangleGroups, so leaf tests read compact SoA data instead of whole bvhTris. The
+// binary tree stays the source of truth: hits are reported as its primitive indices, and the tree must
+// be collapsed again after the binary one is rebuilt or refitted.
+template <int N>
+class WideBVH {
+public:
+    std::vector<WideBVHNode<N>> nodes; // node 0 is the root
+    std::vector<TriangleGroup<N>> triangles;
+    int maxDepth; // wide levels below the root
+
+    WideBVH();
+
+    void build(const BVH& source);
+
+    // every visited node pops one entry and pushes at most N, so each level adds at most N - 1
+    int traversalStackSize() const { return (maxDepth + 1) * (N - 1) + 1; }
+
+    // closest hit within [r.tmin, r.tmax]; out_triIdx indexes the primitives of the source BVH
+    bool intersectNearest(const Ray& r, float& out_t, int& out_triIdx, float& out_u, float& out_v) const;
+    // true as soon as any triangle is hit within (r.tmin, r.tmax); for shadow rays
+    bool occluded(const Ray& r) const;
+
+private:
+    int collapse(const BVH& source, int binaryNode, int depth);
+    int appendLeaf(const BVH& source, int first, int count);
+};
+
+typedef WideBVH<4> BVH4;
+typedef WideBVH<8> BVH8;
@@ -0,0 +1,16 @@
+#version 420 core
+
+// Shows the accumulated radiance of raytracing_fragment.glsl in the window
+uniform sampler2D uAccum;
+
+out vec4 fragColor;
+
+void main() {
+    vec3 col = texelFetch(uAccum, ivec2(gl_FragCoord.xy), 0).rgb;
+
+    // Reinhard tone mapping + gamma correction
+    col = col / (vec3(1.0) + col);
+    col = pow(col, vec3(1.0/2.2));
+
+    fragColor = vec4(col, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,741 @@
+// Shared by raytracing_fragment.glsl and the wavefront_*.comp kernels, pulled in with #include (see
+// Shader): scene buffers and their accessors, closest-hit and any-hit traversal, the hash RNG, light
+// sampling and camera ray generation. The including file supplies #version.
+//
+// With SCENE_SSBO defined (GPUScene::shaderDefines, GL 4.3) triangles, nodes and instances are read
+// from std430 storage buffers on bindings 4-7 holding the same bytes as the texture buffers below,
+// which lifts the GL_MAX_TEXTURE_BUFFER_SIZE limit and reads integer fields as they are. Without it
+// they are texture buffers, for GL 4.2 contexts.
+#ifdef SCENE_SSBO
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
+
+// Scene triangles packed in a texture buffer, in object space, with the edges precomputed for the
+// intersection test. Each triangle uses 3 RGBA32F texels:
+// 0: v0.xyz, material index (integer bits)
+// 1: e1 = v1 - v0, w unused
+// 2: e2 = v2 - v0, w unused
+
+// Materials, indexed by the triangle's material and only read for the closest hit, 2 texels each:
+// 0: albedo.rgb, w unused
+// 1: emission.rgb, w unused
+uniform samplerBuffer uMaterials;
+
+// BVH nodes packed as 2 texels per node (32 bytes):
+// texel0: bmin.xyz, bmax.x
+// texel1: bmax.yz, offset, count (integer bits)
+// uBVHNodes holds every bottom-level tree (leaves index uTriangles) with indices relative to the
+// tree, uTLASNodes the top-level tree (leaves index uInstances)
+
+// Instances packed as 7 texels each:
+// 0-2: rows of the world-to-object transform
+// 3-5: rows of the object-to-world transform
+// 6:   bottom-level root node, first triangle, triangle count, unused (integer bits)
+
+#ifdef SCENE_SSBO
+struct PackedTriangle {
+    vec3 v0;
+    int material;
+    vec4 e1, e2;
+};
+
+struct PackedBVHNode {
+    vec3 bmin;
+    float bmaxX;
+    vec2 bmaxYZ;
+    int offset;
+    int count;
+};
+
+struct PackedInstance {
+    vec4 w2o[3];
+    vec4 o2w[3];
+    ivec4 info; // root, primStart, primCount, unused
+};
+
+layout(std430, binding = 4) readonly buffer SceneTriangles { PackedTriangle sceneTriangles[]; };
+layout(std430, binding = 5) readonly buffer SceneBVHNodes { PackedBVHNode sceneBVHNodes[]; };
+layout(std430, binding = 6) readonly buffer SceneTLASNodes { PackedBVHNode sceneTLASNodes[]; };
+layout(std430, binding = 7) readonly buffer SceneInstances { PackedInstance sceneInstances[]; };
+#else
+uniform samplerBuffer uTriangles;
+uniform samplerBuffer uBVHNodes;
+uniform samplerBuffer uTLASNodes;
+uniform samplerBuffer uInstances;
+#endif
+uniform int uInstanceCount;
+
+// Emissive triangles in world space, 4 texels each, with an alias table over their power:
+// 0: v0.xyz, alias threshold
+// 1: v1.xyz, alias index (integer bits)
+// 2: v2.xyz, probability of picking this light
+// 3: emission.rgb, area
+uniform samplerBuffer uLights;
+uniform int uLightCount;
+
+// Light BVH over uLights, depth-first, one light per leaf, 3 texels per node:
+// 0: bmin.xyz, summed power
+// 1: bmax.xyz, angle of the emitter normal cone
+// 2: cone axis.xyz, right child or -(light + 1) for a leaf (integer bits)
+uniform samplerBuffer uLightTree;
+uniform int uUseLightTree; // 0 picks lights by power alone
+
+// Camera
+uniform vec3 uCamPos;
+uniform mat4 uInvViewProj;
+uniform vec2 uResolution;
+
+// Optional top-level scene bounds for early-out
+uniform vec3 uSceneMin;
+uniform vec3 uSceneMax;
+
+// Hash-based RNG
+uint hash(uvec3 x) {
+    x = x * 1664525u + 1013904223u;
+    x.x += x.y * x.z; x.y += x.z * x.x; x.z += x.x * x.y;
+    x ^= x >> 16u;
+    x += x << 3u;
+    x ^= x >> 4u;
+    x *= 0x27d4eb2du;
+    x ^= x >> 15u;
+    return x.x;
+}
+
+float rand(inout uvec3 state) {
+    state = uvec3(hash(state), hash(state.yxz), hash(state.zxy));
+    return float(state.x) / 4294967296.0;
+}
+
+struct Ray { 
+    vec3 o; 
+    vec3 d; 
+    float tMin; 
+    float tMax; 
+};
+
+struct AABB { 
+    vec3 bmin; 
+    vec3 bmax; 
+};
+
+AABB aabb_make(vec3 mn, vec3 mx) { 
+    AABB b; 
+    b.bmin = mn; 
+    b.bmax = mx; 
+    return b; 
+}
+
+// Slab test; tEnter is where the ray enters the box, used to visit nearer nodes first
+bool intersectAABB(Ray r, AABB b, out float tEnter) {
+    vec3 invD = 1.0 / r.d;
+    vec3 t0s = (b.bmin - r.o) * invD;
+    vec3 t1s = (b.bmax - r.o) * invD;
+    vec3 tsm = min(t0s, t1s);
+    vec3 tsM = max(t0s, t1s);
+    float t_enter = max(r.tMin, max(tsm.x, max(tsm.y, tsm.z)));
+    float t_exit = min(r.tMax, min(tsM.x, min(tsM.y, tsM.z)));
+    tEnter = t_enter;
+    return t_exit >= t_enter && t_exit > 0;
+}
+
+bool intersectAABB(Ray r, AABB b) {
+    float tEnter;
+    return intersectAABB(r, b, tEnter);
+}
+
+// Intersection record: the first vertex and the edges to the other two
+struct TriangleData {
+    vec3 v0; 
+    vec3 e1; 
+    vec3 e2; 
+    int material;
+};
+
+struct MaterialData {
+    vec3 albedo; 
+    vec3 emission; 
+};
+
+TriangleData getTriangle(int i) {
+    TriangleData T;
+#ifdef SCENE_SSBO
+    T.v0 = sceneTriangles[i].v0;
+    T.material = sceneTriangles[i].material;
+    T.e1 = sceneTriangles[i].e1.xyz;
+    T.e2 = sceneTriangles[i].e2.xyz;
+#else
+    int base = i * 3;
+    vec4 t0 = texelFetch(uTriangles, base + 0);
+    T.v0 = t0.xyz;
+    T.material = floatBitsToInt(t0.w);
+    T.e1 = texelFetch(uTriangles, base + 1).xyz;
+    T.e2 = texelFetch(uTriangles, base + 2).xyz;
+#endif
+    return T;
+}
+
+MaterialData getMaterial(int m) {
+    MaterialData M;
+    M.albedo = texelFetch(uMaterials, m * 2).rgb;
+    M.emission = texelFetch(uMaterials, m * 2 + 1).rgb;
+    return M;
+}
+
+// Moller-Trumbore with the edges taken from the triangle record
+bool intersectTriangle(Ray ray, TriangleData T, out float t, out float u, out float v) {
+    vec3 e1 = T.e1;
+    vec3 e2 = T.e2;
+    vec3 p = cross(ray.d, e2);
+    float det = dot(e1, p);
+    if (abs(det) < 1e-8) return false;
+    float invDet = 1.0 / det;
+    vec3 tvec = ray.o - T.v0;
+    u = dot(tvec, p) * invDet;
+    if (u < 0.0 || u > 1.0) return false;
+    vec3 q = cross(tvec, e1);
+    v = dot(ray.d, q) * invDet; 
+    if (v < 0.0 || (u + v) > 1.0) return false;
+    t = dot(e2, q) * invDet;
+    return t > ray.tMin && t < ray.tMax;
+}
+
+// BVH accessors
+// Nodes are the 32-byte CPU BVHNode: bmin, bmax, offset, count, read as two texels or one PackedBVHNode.
+// Depth-first order: an interior node's left child is the next node, offset is its right child.
+// A leaf has count > 0 and offset is its first triangle.
+struct BVHNode { 
+    AABB b; 
+    int offset; 
+    int count; 
+};
+
+BVHNode decodeBVHNode(vec4 a, vec4 b) {
+    BVHNode n;
+    n.b.bmin = a.xyz;
+    n.b.bmax = vec3(a.w, b.xy);
+    n.offset = floatBitsToInt(b.z);
+    n.count = floatBitsToInt(b.w);
+    return n;
+}
+
+#ifdef SCENE_SSBO
+BVHNode decodeBVHNode(PackedBVHNode p) {
+    BVHNode n;
+    n.b.bmin = p.bmin;
+    n.b.bmax = vec3(p.bmaxX, p.bmaxYZ);
+    n.offset = p.offset;
+    n.count = p.count;
+    return n;
+}
+
+BVHNode getBVHNode(int idx) {
+    return decodeBVHNode(sceneBVHNodes[idx]);
+}
+
+BVHNode getTLASNode(int idx) {
+    return decodeBVHNode(sceneTLASNodes[idx]);
+}
+#else
+BVHNode getBVHNode(int idx) {
+    int base = idx * 2;
+    return decodeBVHNode(texelFetch(uBVHNodes, base + 0), texelFetch(uBVHNodes, base + 1));
+}
+
+BVHNode getTLASNode(int idx) {
+    int base = idx * 2;
+    return decodeBVHNode(texelFetch(uTLASNodes, base + 0), texelFetch(uTLASNodes, base + 1));
+}
+#endif
+
+// Instance accessors
+struct Instance {
+    vec4 w2o[3]; // rows of the world-to-object transform
+    vec4 o2w[3]; // rows of the object-to-world transform
+    int root;
+    int primStart;
+    int primCount;
+};
+
+Instance getInstance(int i) {
+    Instance inst;
+#ifdef SCENE_SSBO
+    for (int r = 0; r < 3; ++r) {
+        inst.w2o[r] = sceneInstances[i].w2o[r];
+        inst.o2w[r] = sceneInstances[i].o2w[r];
+    }
+    ivec4 c = sceneInstances[i].info;
+#else
+    int base = i * 7;
+    for (int r = 0; r < 3; ++r) {
+        inst.w2o[r] = texelFetch(uInstances, base + r);
+        inst.o2w[r] = texelFetch(uInstances, base + 3 + r);
+    }
+    ivec4 c = floatBitsToInt(texelFetch(uInstances, base + 6));
+#endif
+    inst.root = c.x;
+    inst.primStart = c.y;
+    inst.primCount = c.z;
+    return inst;
+}
+
+vec3 transformPoint(vec4 rows[3], vec3 p) {
+    vec4 h = vec4(p, 1.0);
+    return vec3(dot(rows[0], h), dot(rows[1], h), dot(rows[2], h));
+}
+
+vec3 transformVector(vec4 rows[3], vec3 d) {
+    return vec3(dot(rows[0].xyz, d), dot(rows[1].xyz, d), dot(rows[2].xyz, d));
+}
+
+// object-space normal to world space: inverse transpose of object-to-world = transpose of world-to-object
+vec3 transformNormal(Instance inst, vec3 n) {
+    return inst.w2o[0].xyz * n.x + inst.w2o[1].xyz * n.y + inst.w2o[2].xyz * n.z;
+}
+
+// Traversal. GPUScene::shaderDefines sizes the per-ray stack from the deepest tree it uploaded
+// (BVH::traversalStackSize: one pending sibling per level plus both children of the current node), so
+// shallow scenes keep fewer registers. Scenes deeper than its budget define BVH_STACKLESS instead and
+// walk the trees through parent links, with no stack to overflow.
+#ifndef BVH_STACKLESS
+#ifndef BVH_STACK_SIZE
+#define BVH_STACK_SIZE 64
+#endif
+
+// Closest hit in one bottom-level BVH. The ray is in that tree's object space; tHit only shrinks.
+// Node and triangle indices inside the tree are relative to root and primStart.
+// Front to back: both children are slab-tested at their parent and the nearer one is popped first;
+// nodes whose entry distance is beyond a hit found after they were pushed are skipped.
+bool intersectBLAS(Ray ray, int root, int primStart, inout float tHit, inout int triIdx, inout float outU, inout float outV) {
+    bool found = false;
+    Ray r = ray; 
+    r.tMax = tHit;
+    float tRoot;
+    if (!intersectAABB(r, getBVHNode(root).b, tRoot)) return false;
+    int stack[BVH_STACK_SIZE]; 
+    float stackT[BVH_STACK_SIZE];
+    int sp = 0; 
+    stack[sp] = root; 
+    stackT[sp++] = tRoot;
+    while (sp > 0) {
+        --sp;
+        if (stackT[sp] > tHit) continue;
+        int ni = stack[sp];
+        BVHNode node = getBVHNode(ni);
+        if (node.count > 0) { // leaf node
+            for (int i = 0; i < node.count; ++i) {
+                int idx = primStart + node.offset + i;
+                TriangleData T = getTriangle(idx);
+                float tu, tv, tt;
+                if (intersectTriangle(ray, T, tt, tu, tv)) {
+                    if (tt < tHit) { 
+                        tHit = tt; 
+                        triIdx = idx; 
+                        outU = tu; 
+                        outV = tv; 
+                        found = true;
+                    }
+                }
+            }
+        } else {
+            int a = ni + 1, b = root + node.offset;
+            float ta, tb;
+            r.tMax = tHit;
+            bool hitA = intersectAABB(r, getBVHNode(a).b, ta);
+            bool hitB = intersectAABB(r, getBVHNode(b).b, tb);
+            if (hitA && hitB && ta < tb) { // push the farther child first
+                int ti = a; a = b; b = ti;
+                float tt = ta; ta = tb; tb = tt;
+            }
+            if (hitA) { stack[sp] = a; stackT[sp++] = ta; }
+            if (hitB) { stack[sp] = b; stackT[sp++] = tb; }
+        }
+    }
+    return found;
+}
+
+// Walks the top-level BVH and traces every overlapped instance with the ray moved into its object space.
+// The object-space direction stays unnormalized, so hit distances are the same in both spaces.
+bool intersectSceneBVH(Ray ray, out float tHit, out int triIdx, out int instIdx, out float outU, out float outV) {
+    tHit = ray.tMax; 
+    triIdx = -1; 
+    instIdx = -1;
+    outU = 0.0; 
+    outV = 0.0;
+    if (uInstanceCount == 0) return false;
+    // root node, then front to back like intersectBLAS
+    Ray r = ray; 
+    float tRoot;
+    if (!intersectAABB(r, getTLASNode(0).b, tRoot)) return false;
+    int stack[BVH_STACK_SIZE]; 
+    float stackT[BVH_STACK_SIZE];
+    int sp = 0; 
+    stack[sp] = 0; 
+    stackT[sp++] = tRoot;
+    while (sp > 0) {
+        --sp;
+        if (stackT[sp] > tHit) continue;
+        int ni = stack[sp];
+        BVHNode node = getTLASNode(ni);
+        if (node.count > 0) { // leaf node: instances
+            for (int i = 0; i < node.count; ++i) {
+                Instance inst = getInstance(node.offset + i);
+                if (inst.primCount == 0) continue;
+                Ray objRay = ray;
+                objRay.o = transformPoint(inst.w2o, ray.o);
+                objRay.d = transformVector(inst.w2o, ray.d);
+                if (intersectBLAS(objRay, inst.root, inst.primStart, tHit, triIdx, outU, outV)) instIdx = node.offset + i;
+            }
+        } else {
+            int a = ni + 1, b = node.offset;
+            float ta, tb;
+            r.tMax = tHit;
+            bool hitA = intersectAABB(r, getTLASNode(a).b, ta);
+            bool hitB = intersectAABB(r, getTLASNode(b).b, tb);
+            if (hitA && hitB && ta < tb) { // push the farther child first
+                int ti = a; a = b; b = ti;
+                float tt = ta; ta = tb; tb = tt;
+            }
+            if (hitA) { stack[sp] = a; stackT[sp++] = ta; }
+            if (hitB) { stack[sp] = b; stackT[sp++] = tb; }
+        }
+    }
+    return triIdx >= 0;
+}
+
+// Any hit in one bottom-level BVH within (tMin, tMax); returns at the first triangle hit
+bool occludedBLAS(Ray ray, int root, int primStart) {
+    int stack[BVH_STACK_SIZE]; 
+    int sp = 0; 
+    stack[sp++] = root; 
+    while (sp > 0) {
+        int ni = stack[--sp];
+        BVHNode node = getBVHNode(ni);
+        if (!intersectAABB(ray, node.b)) continue;
+        if (node.count > 0) { // leaf node
+            for (int i = 0; i < node.count; ++i) {
+                float tu, tv, tt;
+                if (intersectTriangle(ray, getTriangle(primStart + node.offset + i), tt, tu, tv)) return true;
+            }
+        } else {
+            stack[sp++] = ni + 1;
+            stack[sp++] = root + node.offset;
+        }
+    }
+    return false;
+}
+
+// Shadow ray query: true if anything lies between ray.tMin and ray.tMax. Unlike intersectSceneBVH it
+// keeps no closest distance or hit record and stops at the first hit.
+bool occluded(Ray ray) {
+    if (uInstanceCount == 0) return false;
+    int stack[BVH_STACK_SIZE]; 
+    int sp = 0; 
+    stack[sp++] = 0; 
+    while (sp > 0) {
+        int ni = stack[--sp];
+        BVHNode node = getTLASNode(ni);
+        if (!intersectAABB(ray, node.b)) continue;
+        if (node.count > 0) { // leaf node: instances
+            for (int i = 0; i < node.count; ++i) {
+                Instance inst = getInstance(node.offset + i);
+                if (inst.primCount == 0) continue;
+                Ray objRay = ray;
+                objRay.o = transformPoint(inst.w2o, ray.o);
+                objRay.d = transformVector(inst.w2o, ray.d);
+                if (occludedBLAS(objRay, inst.root, inst.primStart)) return true;
+            }
+        } else {
+            stack[sp++] = ni + 1;
+            stack[sp++] = node.offset;
+        }
+    }
+    return false;
+}
+#else
+// Parent of every node, -1 at a root, relative to its tree like the child indices: uBVHParents in the
+// order of uBVHNodes, uTLASParents in that of uTLASNodes. One R32I texel per node.
+uniform isamplerBuffer uBVHParents;
+uniform isamplerBuffer uTLASParents;
+
+int getBVHParent(int root, int i) {
+    int p = texelFetch(uBVHParents, i).r;
+    return p < 0 ? -1 : root + p;
+}
+
+int getTLASParent(int i) {
+    return texelFetch(uTLASParents, i).r;
+}
+
+// True if box a is visited before box b, by their centers along the ray. Unlike entry distances this
+// does not change as tHit shrinks, so the order picked on the way down is found again on the way up.
+bool visitFirst(vec3 d, AABB a, AABB b) {
+    return dot((b.bmin + b.bmax) - (a.bmin + a.bmax), d) >= 0.0;
+}
+
+// Stackless closest hit in one bottom-level BVH. A node is entered from its parent, its near child or
+// its far child, told apart by the node visited last: from the parent it is slab-tested and either
+// descended into (leaves are intersected) or left again; after the near child comes the far one, after
+// the far child the parent. Indices are relative to root and primStart as in the stack version.
+bool intersectBLAS(Ray ray, int root, int primStart, inout float tHit, inout int triIdx, inout float outU, inout float outV) {
+    bool found = false;
+    Ray r = ray;
+    int ni = root;
+    int last = -1; // the root is entered from its missing parent
+    while (ni >= 0) {
+        int parent = getBVHParent(root, ni);
+        BVHNode node = getBVHNode(ni);
+        int next = parent;
+        int nearChild = ni + 1, farChild = root + node.offset;
+        if (node.count == 0 && !visitFirst(ray.d, getBVHNode(nearChild).b, getBVHNode(farChild).b)) {
+            nearChild = root + node.offset;
+            farChild = ni + 1;
+        }
+        if (last == parent) {
+            r.tMax = tHit;
+            float tEnter;
+            if (intersectAABB(r, node.b, tEnter)) {
+                if (node.count > 0) { // leaf node
+                    for (int i = 0; i < node.count; ++i) {
+                        int idx = primStart + node.offset + i;
+                        float tu, tv, tt;
+                        if (intersectTriangle(ray, getTriangle(idx), tt, tu, tv) && tt < tHit) {
+                            tHit = tt;
+                            triIdx = idx;
+                            outU = tu;
+                            outV = tv;
+                            found = true;
+                        }
+                    }
+                } else {
+                    next = nearChild;
+                }
+            }
+        } else if (last == nearChild) {
+            next = farChild;
+        }
+        last = ni;
+        ni = next;
+    }
+    return found;
+}
+
+// Stackless walk of the top-level BVH, same states as intersectBLAS; instances as in the stack version
+bool intersectSceneBVH(Ray ray, out float tHit, out int triIdx, out int instIdx, out float outU, out float outV) {
+    tHit = ray.tMax;
+    triIdx = -1;
+    instIdx = -1;
+    outU = 0.0;
+    outV = 0.0;
+    if (uInstanceCount == 0) return false;
+    Ray r = ray;
+    int ni = 0;
+    int last = -1;
+    while (ni >= 0) {
+        int parent = getTLASParent(ni);
+        BVHNode node = getTLASNode(ni);
+        int next = parent;
+        int nearChild = ni + 1, farChild = node.offset;
+        if (node.count == 0 && !visitFirst(ray.d, getTLASNode(nearChild).b, getTLASNode(farChild).b)) {
+            nearChild = node.offset;
+            farChild = ni + 1;
+        }
+        if (last == parent) {
+            r.tMax = tHit;
+            float tEnter;
+            if (intersectAABB(r, node.b, tEnter)) {
+                if (node.count > 0) { // leaf node: instances
+                    for (int i = 0; i < node.count; ++i) {
+                        Instance inst = getInstance(node.offset + i);
+                        if (inst.primCount == 0) continue;
+                        Ray objRay = ray;
+                        objRay.o = transformPoint(inst.w2o, ray.o);
+                        objRay.d = transformVector(inst.w2o, ray.d);
+                        if (intersectBLAS(objRay, inst.root, inst.primStart, tHit, triIdx, outU, outV)) instIdx = node.offset + i;
+                    }
+                } else {
+                    next = nearChild;
+                }
+            }
+        } else if (last == nearChild) {
+            next = farChild;
+        }
+        last = ni;
+        ni = next;
+    }
+    return triIdx >= 0;
+}
+
+// Stackless any hit in one bottom-level BVH; children in node order, as any hit needs no ordering
+bool occludedBLAS(Ray ray, int root, int primStart) {
+    int ni = root;
+    int last = -1;
+    while (ni >= 0) {
+        int parent = getBVHParent(root, ni);
+        BVHNode node = getBVHNode(ni);
+        int next = parent;
+        if (last == parent) {
+            if (intersectAABB(ray, node.b)) {
+                if (node.count > 0) { // leaf node
+                    for (int i = 0; i < node.count; ++i) {
+                        float tu, tv, tt;
+                        if (intersectTriangle(ray, getTriangle(primStart + node.offset + i), tt, tu, tv)) return true;
+                    }
+                } else {
+                    next = ni + 1;
+                }
+            }
+        } else if (last == ni + 1) {
+            next = root + node.offset;
+        }
+        last = ni;
+        ni = next;
+    }
+    return false;
+}
+
+// Stackless shadow ray query over the top-level BVH
+bool occluded(Ray ray) {
+    if (uInstanceCount == 0) return false;
+    int ni = 0;
+    int last = -1;
+    while (ni >= 0) {
+        int parent = getTLASParent(ni);
+        BVHNode node = getTLASNode(ni);
+        int next = parent;
+        if (last == parent) {
+            if (intersectAABB(ray, node.b)) {
+                if (node.count > 0) { // leaf node: instances
+                    for (int i = 0; i < node.count; ++i) {
+                        Instance inst = getInstance(node.offset + i);
+                        if (inst.primCount == 0) continue;
+                        Ray objRay = ray;
+                        objRay.o = transformPoint(inst.w2o, ray.o);
+                        objRay.d = transformVector(inst.w2o, ray.d);
+                        if (occludedBLAS(objRay, inst.root, inst.primStart)) return true;
+                    }
+                } else {
+                    next = ni + 1;
+                }
+            }
+        } else if (last == ni + 1) {
+            next = node.offset;
+        }
+        last = ni;
+        ni = next;
+    }
+    return false;
+}
+#endif
+
+// Cosine-weighted hemisphere sampling
+vec3 cosineSampleHemisphere(float u1, float u2) {
+    float r = sqrt(u1);
+    float theta = 6.2831853 * u2;
+    float x = r * cos(theta);
+    float y = r * sin(theta);
+    float z = sqrt(max(0.0, 1.0 - u1));
+    return vec3(x, y, z);
+}
+
+mat3 basisFromNormal(vec3 n) {
+    vec3 w = normalize(n);
+    vec3 a = abs(w.z) < 0.999 ? vec3(0,0,1) : vec3(0,1,0);
+    vec3 v = normalize(cross(w, a));
+    vec3 u = cross(v, w);
+    return mat3(u, v, w);
+}
+
+// Upper bound of the light a tree node sends to p (LightBVH::importance): power over distance squared,
+// times the best cosines the node's bounding sphere and normal cone allow at the emitter and at p
+float lightImportance(int node, vec3 p, vec3 N) {
+    vec4 t0 = texelFetch(uLightTree, node * 3);
+    vec4 t1 = texelFetch(uLightTree, node * 3 + 1);
+    vec3 axis = texelFetch(uLightTree, node * 3 + 2).xyz;
+    vec3 center = (t0.xyz + t1.xyz) * 0.5;
+    float r2 = dot(t1.xyz - center, t1.xyz - center);
+    vec3 toNode = center - p;
+    float d2 = dot(toNode, toNode);
+    if (d2 <= r2) return t0.w / max(r2, 1e-8);
+
+    vec3 dir = toNode / sqrt(d2);
+    float thetaU = asin(min(sqrt(r2 / d2), 1.0));
+    float thetaE = max(0.0, acos(clamp(dot(axis, -dir), -1.0, 1.0)) - t1.w - thetaU);
+    if (thetaE >= 1.5707963) return 0.0;
+    float thetaI = max(0.0, acos(clamp(dot(N, dir), -1.0, 1.0)) - thetaU);
+    if (thetaI >= 1.5707963) return 0.0;
+    return t0.w * cos(thetaE) * cos(thetaI) / d2;
+}
+
+// Walk the light tree from the root, picking each child by importance; -1 if no light can reach p
+int pickLightTree(float u, vec3 p, vec3 N, out float prob) {
+    prob = 1.0;
+    int node = 0;
+    int offset = floatBitsToInt(texelFetch(uLightTree, 2).w);
+    while (offset >= 0) {
+        float wl = lightImportance(node + 1, p, N);
+        float wr = lightImportance(offset, p, N);
+        if (wl + wr <= 0.0) return -1;
+        float pl = wl / (wl + wr);
+        if (u < pl) {
+            u = min(u / pl, 0.99999994);
+            prob *= pl;
+            node = node + 1;
+        } else {
+            u = min((u - pl) / (1.0 - pl), 0.99999994);
+            prob *= 1.0 - pl;
+            node = offset;
+        }
+        offset = floatBitsToInt(texelFetch(uLightTree, node * 3 + 2).w);
+    }
+    return -offset - 1;
+}
+
+// Pick one emissive triangle for the shading point (light tree, or alias table over power), then a
+// uniform point on it
+bool sampleLight(inout uvec3 rng, vec3 p, vec3 N, out vec3 pos, out vec3 n, out vec3 Le, out float pdf) {
+    pdf = 0.0;
+    if (uLightCount == 0) return false;
+    float x = rand(rng);
+    int pick;
+    float prob;
+    if (uUseLightTree != 0) {
+        pick = pickLightTree(x, p, N, prob);
+        if (pick < 0) return false;
+    } else {
+        x *= float(uLightCount);
+        pick = clamp(int(x), 0, uLightCount - 1);
+        if (x - float(pick) >= texelFetch(uLights, pick * 4).w)
+            pick = floatBitsToInt(texelFetch(uLights, pick * 4 + 1).w);
+        prob = texelFetch(uLights, pick * 4 + 2).w;
+    }
+    vec4 t0 = texelFetch(uLights, pick * 4);
+    vec4 t1 = texelFetch(uLights, pick * 4 + 1);
+    vec4 t2 = texelFetch(uLights, pick * 4 + 2);
+    vec4 t3 = texelFetch(uLights, pick * 4 + 3);
+    vec3 v0 = t0.xyz;
+    vec3 v1 = t1.xyz;
+    vec3 v2 = t2.xyz;
+    float r1 = rand(rng); float r2 = rand(rng);
+    float su1 = sqrt(r1);
+    float b0 = 1.0 - su1;
+    float b1 = r2 * su1;
+    float b2 = 1.0 - b0 - b1;
+    pos = v0 * b0 + v1 * b1 + v2 * b2;
+    n = normalize(cross(v1 - v0, v2 - v0));
+    Le = t3.rgb;
+    pdf = prob / t3.w;
+    return true;
+}
+
+// Ray generation via inverse view-projection
+vec3 generateRayDir(vec2 pixelUV, inout uvec3 rng) {
+    vec2 jitter = vec2(rand(rng), rand(rng));
+    vec2 ndc = ((pixelUV + jitter) / uResolution) * 2.0 - 1.0; // [-1,1]
+    // openGL nearP.z = -1, Vulkan / DirectX / Metal nearP.z = 0
+    vec4 nearP = uInvViewProj * vec4(ndc, -1.0, 1.0); 
+    nearP /= nearP.w;
+    vec4 farP  = uInvViewProj * vec4(ndc, 1.0, 1.0);
+    farP /= farP.w;
+    vec3 dir = normalize(farP.xyz - nearP.xyz);
+    return dir;
+}
@@ -0,0 +1,79 @@
+// Shared by the wavefront_*.comp kernels (WavefrontRenderer): path state, ray queues and their counters.
+// Every kernel runs 64 threads per group. Dispatches stay within the 65535 groups GL guarantees
+// (GL_MAX_COMPUTE_WORK_GROUP_COUNT), so on larger images each thread strides over several entries.
+
+layout(local_size_x = 64) in;
+
+const uint MAX_GROUPS = 65535u;
+
+// distance between the entries one thread handles
+uint threadStride() {
+    return gl_NumWorkGroups.x * 64u;
+}
+
+// One path per pixel, indexed y * width + x
+struct PathState {
+    vec4 origin;     // xyz: ray origin of the next segment
+    vec4 direction;  // xyz: ray direction of the next segment
+    vec4 throughput; // rgb
+    vec4 radiance;   // rgb: summed over the samples of this frame
+    uvec4 rng;       // xyz: hash RNG state, carried from sample to sample like the fragment path
+    vec4 hit;        // t, triangle, instance (integer bits), unused; written by extend for shade
+};
+
+layout(std430, binding = 0) buffer Paths {
+    PathState paths[];
+};
+
+// Two queues of path indices, uPathCount entries each: the paths extended at this depth and the
+// paths that continue to the next
+layout(std430, binding = 1) buffer Queues {
+    uint queue[];
+};
+
+// Next event estimation rays written by shade, tested by shadow
+struct ShadowRay {
+    vec4 origin;       // xyz, w: tMax
+    vec4 direction;    // xyz, w: path index (integer bits)
+    vec4 contribution; // rgb: radiance added to the path if the light is visible
+};
+
+layout(std430, binding = 2) buffer ShadowRays {
+    ShadowRay shadowRays[];
+};
+
+// Queue lengths, plus dispatch arguments (groups x, y, z) for glDispatchComputeIndirect that grow
+// with them, so the host never reads a count back
+struct DispatchArgs {
+    uint x, y, z, pad;
+};
+
+layout(std430, binding = 3) buffer Counters {
+    uint queueCount[2];
+    uint shadowCount;
+    uint counterPad;
+    DispatchArgs queueGroups[2];
+    DispatchArgs shadowGroups;
+};
+
+uniform int uPathCount;
+uniform int uQueue; // queue read by this dispatch, 0 or 1
+
+// Appends a path to queue q; the first thread to take a slot in a new group of 64 adds that group,
+// up to MAX_GROUPS
+void pushPath(int q, uint path) {
+    uint slot = atomicAdd(queueCount[q], 1u);
+    if (slot % 64u == 0u && slot / 64u < MAX_GROUPS) atomicAdd(queueGroups[q].x, 1u);
+    queue[uint(q * uPathCount) + slot] = path;
+}
+
+void pushShadowRay(ShadowRay r) {
+    uint slot = atomicAdd(shadowCount, 1u);
+    if (slot % 64u == 0u && slot / 64u < MAX_GROUPS) atomicAdd(shadowGroups.x, 1u);
+    shadowRays[slot] = r;
+}
+
+// Path index of entry i of queue uQueue
+int queuedPath(uint i) {
+    return int(queue[uint(uQueue * uPathCount) + i]);
+}
\ No newline at end of file
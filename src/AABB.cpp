@@ -22,14 +22,30 @@ glm::vec3 AABB::centroid() const {
     return 0.5f * (bmin + bmax);
 }
 
+// surface area of the box, 0 for an empty box
+float AABB::surfaceArea() const {
+    glm::vec3 d = bmax - bmin;
+    if (d.x < 0.0f || d.y < 0.0f || d.z < 0.0f) return 0.0f;
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+// axis (0, 1, 2) with the largest extent
+int AABB::maxExtentAxis() const {
+    glm::vec3 d = bmax - bmin;
+    int axis = 0;
+    if (d.y > d.x) axis = 1;
+    if (d.z > d[axis]) axis = 2;
+    return axis;
+}
+
 //Slab intersection.Returns true and writes tnear, tfar if intersects
-//bool AABB::intersectAABB(const AABB& box, const Ray& r, float& out_near, float& out_far) {
-//	glm::vec3 invD = 1.0f / r.d;
-//    glm::vec3 t0s = (bmin - r.o) * invD;
-//    glm::vec3 t1s = (bmax - r.o) * invD;
-//    glm::vec3 tsmaller = glm::min(t0s, t1s);
-//    glm::vec3 tbigger = glm::max(t0s, t1s);
-//	float t_enter = glm::max(r.tmin, glm::max(tsmaller.x, glm::max(tsmaller.y, tsmaller.z)));
-//    float t_exit = glm::min(r.tmax, glm::min(tbigger.x, glm::max(tbigger.y, tbigger.z)));
-//	return t_enter < t_exit && t_exit > 0.0f;
-//}
\ No newline at end of file
+bool AABB::intersectAABB(const Ray& r, float& out_near, float& out_far) const {
+    glm::vec3 invD = 1.0f / r.d;
+    glm::vec3 t0s = (bmin - r.o) * invD;
+    glm::vec3 t1s = (bmax - r.o) * invD;
+    glm::vec3 tsmaller = glm::min(t0s, t1s);
+    glm::vec3 tbigger = glm::max(t0s, t1s);
+    out_near = glm::max(r.tmin, glm::max(tsmaller.x, glm::max(tsmaller.y, tsmaller.z)));
+    out_far = glm::min(r.tmax, glm::min(tbigger.x, glm::min(tbigger.y, tbigger.z)));
+    return out_near <= out_far && out_far > 0.0f;
+}
\ No newline at end of file
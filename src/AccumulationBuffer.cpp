@@ -0,0 +1,79 @@
+#include "AccumulationBuffer.h"
+
+AccumulationBuffer::AccumulationBuffer()
+    : m_Framebuffers{ 0, 0 }, m_Textures{ 0, 0 }
+    , m_Current(0), m_Width(0), m_Height(0), m_SampleCount(0) {}
+
+AccumulationBuffer::~AccumulationBuffer()
+{
+    release();
+}
+
+void AccumulationBuffer::release()
+{
+    if (m_Framebuffers[0]) glDeleteFramebuffers(2, m_Framebuffers);
+    if (m_Textures[0]) glDeleteTextures(2, m_Textures);
+    m_Framebuffers[0] = m_Framebuffers[1] = 0;
+    m_Textures[0] = m_Textures[1] = 0;
+}
+
+bool AccumulationBuffer::resize(int width, int height)
+{
+    if (width == m_Width && height == m_Height && m_Framebuffers[0])
+        return false;
+    release();
+    m_Width = width;
+    m_Height = height;
+    m_Current = 0;
+    m_SampleCount = 0;
+
+    glGenTextures(2, m_Textures);
+    glGenFramebuffers(2, m_Framebuffers);
+    for (int i = 0; i < 2; ++i) {
+        glBindTexture(GL_TEXTURE_2D, m_Textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+        // read with texelFetch only
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, m_Framebuffers[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_Textures[i], 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cerr << "Accumulation framebuffer is incomplete." << std::endl;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return true;
+}
+
+void AccumulationBuffer::beginFrame(Shader& shader, int unit) const
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, m_Framebuffers[1 - m_Current]);
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, m_Textures[m_Current]);
+    shader.SetUniform1i("uAccum", unit);
+    shader.SetUniform1i("uAccumSamples", m_SampleCount);
+}
+
+void AccumulationBuffer::beginComputeFrame(Shader& shader) const
+{
+    glBindImageTexture(0, m_Textures[m_Current], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+    glBindImageTexture(1, m_Textures[1 - m_Current], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+    shader.SetUniform1i("uAccumSamples", m_SampleCount);
+}
+
+void AccumulationBuffer::endFrame(int samples)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    m_Current = 1 - m_Current;
+    m_SampleCount += samples;
+}
+
+void AccumulationBuffer::read(std::vector<glm::vec3>& out) const
+{
+    out.resize(static_cast<size_t>(m_Width) * m_Height);
+    glBindTexture(GL_TEXTURE_2D, m_Textures[m_Current]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, out.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
@@ -1,106 +1,980 @@
 #include "BVH.h"
 
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+#include "TraversalStack.h"
+
 BVHNode::BVHNode()
     : bounds()
-    , left(-1)
-    , right(-1)
-    , start(0)
+    , offset(0)
     , count(0) {}
 
-BVH::BVH() = default;
+BVH::BVH()
+    : inputPrimitiveCount(0)
+    , builtSAHCost(0.0f)
+    , maxDepth(0) {}
 
-int BVH::build_recursive(int start, int end, int maxLeafSize) {
+int BVH::splitRange(int start, int end, AABB& bounds) {
     // compute bounds and centroid bounds
-    AABB bounds; 
+    bounds = AABB();
     AABB centroidBounds;
     for (int i = start; i < end; ++i) {
         bounds.expand(primitives[i].bounds);
         centroidBounds.expand(primitives[i].centroid);
     }
 
-    int nodeIndex = static_cast<int>(nodes.size());
-    nodes.emplace_back();
-    nodes[nodeIndex].bounds = bounds;
-
     int nPrims = end - start;
-    if (nPrims <= maxLeafSize) {
-        nodes[nodeIndex].start = start;
-        nodes[nodeIndex].count = nPrims;
-        nodes[nodeIndex].left = nodes[nodeIndex].right = -1;
+    int mid = -1;
+    if (settings.method == BVHSplitMethod::SAH)
+        mid = partitionSAH(start, end, bounds, centroidBounds);
+    else if (nPrims > settings.maxLeafSize)
+        mid = partitionMedian(start, end, centroidBounds);
+
+    // leaf requested, or degenerate split
+    if (mid <= start || mid >= end) return -1;
+    return mid;
+}
+
+int BVH::build_recursive(int start, int end, std::vector<BVHNode>& out) {
+    AABB bounds;
+    int mid = splitRange(start, end, bounds);
+
+    int nodeIndex = static_cast<int>(out.size());
+    out.emplace_back();
+    out[nodeIndex].bounds = bounds;
+
+    if (mid < 0) {
+        out[nodeIndex].offset = start;
+        out[nodeIndex].count = end - start;
         return nodeIndex;
     }
 
+    // the left subtree starts at nodeIndex + 1
+    build_recursive(start, mid, out);
+    int right = build_recursive(mid, end, out);
+    out[nodeIndex].offset = right;
+    out[nodeIndex].count = 0;
+    return nodeIndex;
+}
+
+// Workers shared by every BVH in the process, so per-frame rebuilds do not respawn threads and a scene
+// of many meshes does not keep a pool per mesh. A build asking for another thread count replaces the
+// pool; builds still running keep the one they started with alive.
+static std::shared_ptr<ThreadPool> sharedBuildPool(int threads) {
+    static std::mutex mutex;
+    static std::shared_ptr<ThreadPool> pool;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!pool || (threads > 0 && pool->size() != threads))
+        pool = std::make_shared<ThreadPool>(threads);
+    return pool;
+}
+
+// Appends a subtree arena (right child indices local to the arena) and returns the index of its root.
+static int appendArena(std::vector<BVHNode>& out, const std::vector<BVHNode>& arena) {
+    int base = static_cast<int>(out.size());
+    for (BVHNode n : arena) {
+        if (!n.isLeaf()) n.offset += base;
+        out.push_back(n);
+    }
+    return base;
+}
+
+void BVH::build_parallel(int start, int end, std::vector<BVHNode>& out, ThreadPool& pool) {
+    if (end - start <= settings.parallelThreshold) {
+        build_recursive(start, end, out);
+        return;
+    }
+
+    AABB bounds;
+    int mid = splitRange(start, end, bounds);
+    if (mid < 0) {
+        out.emplace_back();
+        out.back().bounds = bounds;
+        out.back().offset = start;
+        out.back().count = end - start;
+        return;
+    }
+
+    // the halves touch disjoint primitive ranges, so they can be built concurrently
+    std::vector<BVHNode> leftArena;
+    std::vector<BVHNode> rightArena;
+    TaskGroup group(pool);
+    group.run([&] { build_parallel(start, mid, leftArena, pool); });
+    build_parallel(mid, end, rightArena, pool);
+    group.wait();
+
+    // stitch in the same pre-order as build_recursive: node, left subtree, right subtree
+    int nodeIndex = static_cast<int>(out.size());
+    out.emplace_back();
+    out[nodeIndex].bounds = bounds;
+    appendArena(out, leftArena);
+    int right = appendArena(out, rightArena);
+    out[nodeIndex].offset = right;
+}
+
+int BVH::partitionMedian(int start, int end, const AABB& centroidBounds) {
     // choose split axis by largest extent
-    glm::vec3 extent = centroidBounds.bmax - centroidBounds.bmin;
-    int axis = 0;
-    if (extent.y > extent.x) axis = 1;
-    if ((axis == 0 ? extent.x : extent.y) < extent.z) axis = 2;
+    int axis = centroidBounds.maxExtentAxis();
 
     int mid = (start + end) / 2;
     std::nth_element(primitives.begin() + start, primitives.begin() + mid, primitives.begin() + end,
         [axis](const bvhTri& a, const bvhTri& b) {
-            if (axis == 0) return a.centroid.x < b.centroid.x;
-            if (axis == 1) return a.centroid.y < b.centroid.y;
-            return a.centroid.z < b.centroid.z;
+            return a.centroid[axis] < b.centroid[axis];
         });
+    return mid;
+}
 
-    // if degenerate split, make leaf
-    if (mid == start || mid == end) {
-        nodes[nodeIndex].start = start;
-        nodes[nodeIndex].count = nPrims;
-        nodes[nodeIndex].left = nodes[nodeIndex].right = -1;
-        return nodeIndex;
+// bin of a centroid coordinate, shared by binning and partitioning so both agree
+static int sahBinIndex(float c, float cmin, float scale, int nBins) {
+    int b = static_cast<int>((c - cmin) * scale);
+    return std::min(std::max(b, 0), nBins - 1);
+}
+
+// Finds the cheapest binned SAH plane over prims[0, count). Returns false if all centroids coincide.
+// outCost is the unnormalized sum area(left) * count(left) + area(right) * count(right).
+static bool findBinnedSplit(const bvhTri* prims, int count, const AABB& centroidBounds, int nBins,
+    int& outAxis, int& outBin, float& outCost) {
+    struct Bin {
+        AABB bounds;
+        int count = 0;
+    };
+
+    std::vector<Bin> bins(nBins);
+    std::vector<float> rightArea(nBins);
+    std::vector<int> rightCount(nBins);
+
+    outCost = std::numeric_limits<float>::infinity();
+    outAxis = -1;
+    outBin = -1;
+    for (int axis = 0; axis < 3; ++axis) {
+        float cmin = centroidBounds.bmin[axis];
+        float extent = centroidBounds.bmax[axis] - cmin;
+        if (extent <= 0.0f) continue;
+        float scale = static_cast<float>(nBins) / extent;
+
+        std::fill(bins.begin(), bins.end(), Bin());
+        for (int i = 0; i < count; ++i) {
+            Bin& bin = bins[sahBinIndex(prims[i].centroid[axis], cmin, scale, nBins)];
+            bin.bounds.expand(prims[i].bounds);
+            bin.count++;
+        }
+
+        // sweep from the right, then evaluate every plane between bin b-1 and b from the left
+        AABB acc;
+        int n = 0;
+        for (int b = nBins - 1; b > 0; --b) {
+            acc.expand(bins[b].bounds);
+            n += bins[b].count;
+            rightArea[b] = acc.surfaceArea();
+            rightCount[b] = n;
+        }
+        acc = AABB();
+        n = 0;
+        for (int b = 1; b < nBins; ++b) {
+            acc.expand(bins[b - 1].bounds);
+            n += bins[b - 1].count;
+            if (n == 0 || rightCount[b] == 0) continue;
+            float cost = acc.surfaceArea() * n + rightArea[b] * rightCount[b];
+            if (cost < outCost) {
+                outCost = cost;
+                outAxis = axis;
+                outBin = b;
+            }
+        }
     }
+    return outAxis >= 0;
+}
 
-    int left = build_recursive(start, mid, maxLeafSize);
-    int right = build_recursive(mid, end, maxLeafSize);
-    nodes[nodeIndex].left = left;
-    nodes[nodeIndex].right = right;
-    nodes[nodeIndex].start = 0;
-    nodes[nodeIndex].count = 0;
-    nodes[nodeIndex].bounds = bounds; // already computed
-    return nodeIndex;
+int BVH::partitionSAH(int start, int end, const AABB& bounds, const AABB& centroidBounds) {
+    int nPrims = end - start;
+    if (nPrims <= 1) return -1;
+
+    const int nBins = std::max(2, settings.sahBins);
+    int bestAxis, bestSplit;
+    float bestCost;
+
+    // all centroids coincide: only split if the leaf would be too large
+    if (!findBinnedSplit(&primitives[start], nPrims, centroidBounds, nBins, bestAxis, bestSplit, bestCost))
+        return nPrims > settings.maxLeafSize ? partitionMedian(start, end, centroidBounds) : -1;
+
+    float area = bounds.surfaceArea();
+    if (nPrims <= settings.maxLeafSize) {
+        if (area <= 0.0f) return -1;
+        float leafCost = settings.intersectCost * nPrims;
+        float splitCost = settings.traversalCost + settings.intersectCost * bestCost / area;
+        if (leafCost <= splitCost) return -1;
+    }
+
+    float cmin = centroidBounds.bmin[bestAxis];
+    float scale = static_cast<float>(nBins) / (centroidBounds.bmax[bestAxis] - cmin);
+    auto it = std::partition(primitives.begin() + start, primitives.begin() + end,
+        [&](const bvhTri& t) {
+            return sahBinIndex(t.centroid[bestAxis], cmin, scale, nBins) < bestSplit;
+        });
+    return static_cast<int>(it - primitives.begin());
 }
 
-void BVH::build(std::vector<bvhTri> tris, int maxLeafSize) {
+void BVH::build(std::vector<bvhTri> tris, const BVHBuildSettings& buildSettings) {
+    settings = buildSettings;
     primitives = std::move(tris);
     nodes.clear();
-    if (!primitives.empty()) build_recursive(0, static_cast<int>(primitives.size()), maxLeafSize);
+    dirtyNodeRanges.clear();
+    builtSAHCost = 0.0f;
+    maxDepth = 0;
+    inputPrimitiveCount = static_cast<int>(primitives.size());
+    if (primitives.empty()) return;
+
+    int n = static_cast<int>(primitives.size());
+    if (settings.method == BVHSplitMethod::Morton) {
+        build_lbvh();
+    } else if (settings.method == BVHSplitMethod::SBVH) {
+        build_sbvh();
+    } else if (settings.buildThreads == 1 || n <= settings.parallelThreshold) {
+        build_recursive(0, n, nodes);
+    } else {
+        // node layout is independent of scheduling, so the result matches the single-threaded build
+        build_parallel(0, n, nodes, *sharedBuildPool(settings.buildThreads));
+    }
+    if (settings.treeletPasses > 0)
+        optimizeTreelets();
+    builtSAHCost = computeSAHCost();
+    maxDepth = computeMaxDepth();
+}
+
+void BVH::restore(std::vector<BVHNode> builtNodes, std::vector<bvhTri> builtPrimitives, int inputCount,
+    const BVHBuildSettings& buildSettings) {
+    settings = buildSettings;
+    nodes = std::move(builtNodes);
+    primitives = std::move(builtPrimitives);
+    inputPrimitiveCount = inputCount;
+    dirtyNodeRanges.clear();
+    builtSAHCost = computeSAHCost();
+    maxDepth = computeMaxDepth();
+}
+
+// spreads the low 10 bits of v so that two zero bits separate each of them
+static uint64_t expandBits10(uint64_t v) {
+    v &= 0x3ffull;
+    v = (v | (v << 16)) & 0x30000ffull;
+    v = (v | (v << 8)) & 0x300f00full;
+    v = (v | (v << 4)) & 0x30c30c3ull;
+    v = (v | (v << 2)) & 0x9249249ull;
+    return v;
+}
+
+// same for the low 21 bits, giving 63-bit codes
+static uint64_t expandBits21(uint64_t v) {
+    v &= 0x1fffffull;
+    v = (v | (v << 32)) & 0x1f00000000ffffull;
+    v = (v | (v << 16)) & 0x1f0000ff0000ffull;
+    v = (v | (v << 8)) & 0x100f00f00f00f00full;
+    v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+    v = (v | (v << 2)) & 0x1249249249249249ull;
+    return v;
+}
+
+static uint64_t mortonCode(const glm::vec3& p, int bits) {
+    if (bits > 30) {
+        const float scale = static_cast<float>((1 << 21) - 1);
+        glm::vec3 q = glm::clamp(p, 0.0f, 1.0f) * scale;
+        return (expandBits21(static_cast<uint64_t>(q.x)) << 2) |
+               (expandBits21(static_cast<uint64_t>(q.y)) << 1) |
+                expandBits21(static_cast<uint64_t>(q.z));
+    }
+    const float scale = 1023.0f;
+    glm::vec3 q = glm::clamp(p, 0.0f, 1.0f) * scale;
+    return (expandBits10(static_cast<uint64_t>(q.x)) << 2) |
+           (expandBits10(static_cast<uint64_t>(q.y)) << 1) |
+            expandBits10(static_cast<uint64_t>(q.z));
+}
+
+// Stable LSD radix sort of (key, value) pairs, 8 bits per pass. Every pass histograms one chunk
+// per task, turns the histograms into per-chunk offsets and scatters the chunks in parallel.
+static void radixSortPairs(std::vector<uint64_t>& keys, std::vector<int>& values, int keyBits, ThreadPool* pool) {
+    const int n = static_cast<int>(keys.size());
+    const int nChunks = pool ? std::max(1, std::min(pool->size() * 4, n / 4096)) : 1;
+    const int chunkSize = (n + nChunks - 1) / nChunks;
+
+    std::vector<uint64_t> keysTmp(n);
+    std::vector<int> valuesTmp(n);
+    std::vector<int> offsets(static_cast<size_t>(nChunks) * 256);
+
+    auto forChunks = [&](const std::function<void(int)>& fn) {
+        if (pool && nChunks > 1) pool->parallelFor(0, nChunks, 1, fn);
+        else for (int c = 0; c < nChunks; ++c) fn(c);
+    };
+
+    for (int shift = 0; shift < keyBits; shift += 8) {
+        forChunks([&](int c) {
+            int* hist = &offsets[static_cast<size_t>(c) * 256];
+            std::fill(hist, hist + 256, 0);
+            int end = std::min(n, (c + 1) * chunkSize);
+            for (int i = c * chunkSize; i < end; ++i)
+                hist[(keys[i] >> shift) & 0xff]++;
+        });
+
+        // exclusive scan in digit-major, chunk-minor order keeps the sort stable
+        int sum = 0;
+        for (int d = 0; d < 256; ++d) {
+            for (int c = 0; c < nChunks; ++c) {
+                int& o = offsets[static_cast<size_t>(c) * 256 + d];
+                int count = o;
+                o = sum;
+                sum += count;
+            }
+        }
+
+        forChunks([&](int c) {
+            int* dst = &offsets[static_cast<size_t>(c) * 256];
+            int end = std::min(n, (c + 1) * chunkSize);
+            for (int i = c * chunkSize; i < end; ++i) {
+                int o = dst[(keys[i] >> shift) & 0xff]++;
+                keysTmp[o] = keys[i];
+                valuesTmp[o] = values[i];
+            }
+        });
+        keys.swap(keysTmp);
+        values.swap(valuesTmp);
+    }
+}
+
+void BVH::build_lbvh() {
+    const int n = static_cast<int>(primitives.size());
+    const int bits = settings.mortonBits > 30 ? 63 : 30;
+    std::shared_ptr<ThreadPool> pool = (settings.buildThreads == 1 || n <= settings.parallelThreshold)
+        ? nullptr : sharedBuildPool(settings.buildThreads);
+
+    AABB centroidBounds;
+    for (const auto& p : primitives)
+        centroidBounds.expand(p.centroid);
+    glm::vec3 extent = centroidBounds.bmax - centroidBounds.bmin;
+    glm::vec3 invExtent(extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+                        extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                        extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+    std::vector<uint64_t> codes(n);
+    std::vector<int> order(n);
+    auto computeCodes = [&](int i) {
+        codes[i] = mortonCode((primitives[i].centroid - centroidBounds.bmin) * invExtent, bits);
+        order[i] = i;
+    };
+    if (pool) pool->parallelFor(0, n, 4096, computeCodes);
+    else for (int i = 0; i < n; ++i) computeCodes(i);
+
+    radixSortPairs(codes, order, bits, pool.get());
+
+    std::vector<bvhTri> sorted(n);
+    for (int i = 0; i < n; ++i)
+        sorted[i] = primitives[order[i]];
+    primitives.swap(sorted);
+
+    nodes.reserve(2 * static_cast<size_t>(n));
+    emit_lbvh(codes, 0, n, nodes);
+}
+
+// Emits [start, end) of the sorted primitives in the same pre-order layout as build_recursive.
+// Each node is visited once and its bounds come from its children, so emission is linear in the node count.
+int BVH::emit_lbvh(const std::vector<uint64_t>& codes, int start, int end, std::vector<BVHNode>& out) {
+    int nodeIndex = static_cast<int>(out.size());
+    out.emplace_back();
+
+    int nPrims = end - start;
+    uint64_t diff = codes[start] ^ codes[end - 1];
+    if (nPrims <= settings.maxLeafSize) {
+        AABB bounds;
+        for (int i = start; i < end; ++i)
+            bounds.expand(primitives[i].bounds);
+        out[nodeIndex].bounds = bounds;
+        out[nodeIndex].offset = start;
+        out[nodeIndex].count = nPrims;
+        return nodeIndex;
+    }
+
+    // first index whose code has the highest differing bit set; identical codes split in the middle
+    int mid = (start + end) / 2;
+    if (diff != 0) {
+        int bit = 63;
+        while (!((diff >> bit) & 1ull)) --bit;
+        uint64_t mask = 1ull << bit;
+        mid = static_cast<int>(std::partition_point(codes.begin() + start, codes.begin() + end,
+            [mask](uint64_t c) { return (c & mask) == 0; }) - codes.begin());
+    }
+
+    int left = emit_lbvh(codes, start, mid, out);
+    int right = emit_lbvh(codes, mid, end, out);
+    out[nodeIndex].offset = right;
+    out[nodeIndex].bounds = out[left].bounds;
+    out[nodeIndex].bounds.expand(out[right].bounds);
+    return nodeIndex;
+}
+
+float BVH::computeSAHCost() const {
+    if (nodes.empty()) return 0.0f;
+    float rootArea = nodes[0].bounds.surfaceArea();
+    if (rootArea <= 0.0f) return 0.0f;
+
+    float cost = 0.0f;
+    for (const auto& n : nodes) {
+        float relArea = n.bounds.surfaceArea() / rootArea;
+        if (n.isLeaf())
+            cost += relArea * settings.intersectCost * static_cast<float>(n.count);
+        else
+            cost += relArea * settings.traversalCost;
+    }
+    return cost;
+}
+
+// children always follow their parent in the node array, so one forward sweep sees every parent first
+int BVH::computeMaxDepth() const {
+    std::vector<int> depth(nodes.size(), 0);
+    int deepest = 0;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const BVHNode& n = nodes[i];
+        deepest = std::max(deepest, depth[i]);
+        if (n.isLeaf()) continue;
+        depth[i + 1] = depth[i] + 1;
+        depth[n.offset] = depth[i] + 1;
+    }
+    return deepest;
+}
+
+void BVH::appendParents(std::vector<int>& out) const {
+    size_t first = out.size();
+    out.resize(first + nodes.size(), -1);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const BVHNode& n = nodes[i];
+        if (n.isLeaf()) continue;
+        out[first + i + 1] = static_cast<int>(i);
+        out[first + n.offset] = static_cast<int>(i);
+    }
+}
+
+void BVH::refit() {
+    for (auto& p : primitives)
+        p.updateBounds();
+
+    // children always follow their parent in the node array, so a reverse sweep is bottom-up
+    std::vector<char> changed(nodes.size(), 0);
+    for (int i = static_cast<int>(nodes.size()) - 1; i >= 0; --i) {
+        BVHNode& n = nodes[i];
+        AABB b;
+        if (n.isLeaf()) {
+            for (int k = 0; k < n.count; ++k)
+                b.expand(primitives[n.offset + k].bounds);
+        } else {
+            b = nodes[i + 1].bounds;
+            b.expand(nodes[n.offset].bounds);
+        }
+        changed[i] = b.bmin != n.bounds.bmin || b.bmax != n.bounds.bmax;
+        n.bounds = b;
+    }
+
+    dirtyNodeRanges.clear();
+    for (int i = 0; i < static_cast<int>(nodes.size()); ++i) {
+        if (!changed[i]) continue;
+        if (!dirtyNodeRanges.empty() && dirtyNodeRanges.back().second == i)
+            dirtyNodeRanges.back().second = i + 1;
+        else
+            dirtyNodeRanges.emplace_back(i, i + 1);
+    }
 }
 
-/* Example (kept commented as in original):
+float BVH::refitDegradation() const {
+    if (builtSAHCost <= 0.0f) return 1.0f;
+    return computeSAHCost() / builtSAHCost;
+}
+
+bool BVH::needsRebuild() const {
+    return refitDegradation() > settings.maxRefitDegradation;
+}
+
+void BVH::rebuild() {
+    std::vector<bvhTri> tris = primitives;
+    if (static_cast<int>(tris.size()) != inputPrimitiveCount) {
+        std::stable_sort(tris.begin(), tris.end(), [](const bvhTri& a, const bvhTri& b) { return a.id < b.id; });
+        tris.erase(std::unique(tris.begin(), tris.end(), [](const bvhTri& a, const bvhTri& b) { return a.id == b.id; }), tris.end());
+    }
+    for (auto& t : tris)
+        t.updateBounds();
+    build(std::move(tris), settings);
+}
+
+static AABB overlapBox(const AABB& a, const AABB& b) {
+    AABB o;
+    o.bmin = glm::max(a.bmin, b.bmin);
+    o.bmax = glm::min(a.bmax, b.bmax);
+    return o;
+}
+
+// Bounds of the part of a triangle between two planes lo <= p[axis] <= hi, limited to its current
+// (possibly already clipped) reference bounds
+static AABB clipReference(const bvhTri& ref, int axis, float lo, float hi) {
+    const glm::vec3 v[3] = { ref.v0, ref.v1, ref.v2 };
+    const float planes[2] = { lo, hi };
+    AABB box;
+    for (int i = 0; i < 3; ++i) {
+        const glm::vec3& a = v[i];
+        const glm::vec3& b = v[(i + 1) % 3];
+        if (a[axis] >= lo && a[axis] <= hi) box.expand(a);
+        for (float plane : planes) {
+            if ((a[axis] < plane && b[axis] > plane) || (a[axis] > plane && b[axis] < plane)) {
+                glm::vec3 p = a + (b - a) * ((plane - a[axis]) / (b[axis] - a[axis]));
+                p[axis] = plane;
+                box.expand(p);
+            }
+        }
+    }
+    return overlapBox(box, ref.bounds);
+}
+
+static void setReferenceBounds(bvhTri& ref, const AABB& bounds) {
+    ref.bounds = bounds;
+    ref.centroid = bounds.centroid();
+}
+
+// Binned spatial split: every reference is clipped into each bin it spans, and counted as entering
+// its first bin and leaving its last. Cost is unnormalized, as in findBinnedSplit.
+static bool findSpatialSplit(const std::vector<bvhTri>& refs, const AABB& bounds, int nBins,
+    int& outAxis, float& outPos, float& outCost, int& outLeftCount, int& outRightCount) {
+    struct Bin {
+        AABB bounds;
+        int enter = 0;
+        int exit = 0;
+    };
+
+    std::vector<Bin> bins(nBins);
+    std::vector<float> rightArea(nBins);
+    std::vector<int> rightCount(nBins);
+
+    outCost = std::numeric_limits<float>::infinity();
+    outAxis = -1;
+    for (int axis = 0; axis < 3; ++axis) {
+        float lo = bounds.bmin[axis];
+        float width = (bounds.bmax[axis] - lo) / static_cast<float>(nBins);
+        if (width <= 0.0f) continue;
+        float scale = 1.0f / width;
+
+        std::fill(bins.begin(), bins.end(), Bin());
+        for (const auto& ref : refs) {
+            int b0 = sahBinIndex(ref.bounds.bmin[axis], lo, scale, nBins);
+            int b1 = sahBinIndex(ref.bounds.bmax[axis], lo, scale, nBins);
+            if (b0 == b1) {
+                bins[b0].bounds.expand(ref.bounds);
+            } else {
+                for (int b = b0; b <= b1; ++b) {
+                    float binLo = lo + width * static_cast<float>(b);
+                    float binHi = b == nBins - 1 ? bounds.bmax[axis] : binLo + width;
+                    bins[b].bounds.expand(clipReference(ref, axis, binLo, binHi));
+                }
+            }
+            bins[b0].enter++;
+            bins[b1].exit++;
+        }
+
+        AABB acc;
+        int n = 0;
+        for (int b = nBins - 1; b > 0; --b) {
+            acc.expand(bins[b].bounds);
+            n += bins[b].exit;
+            rightArea[b] = acc.surfaceArea();
+            rightCount[b] = n;
+        }
+        acc = AABB();
+        n = 0;
+        for (int b = 1; b < nBins; ++b) {
+            acc.expand(bins[b - 1].bounds);
+            n += bins[b - 1].enter;
+            if (n == 0 || rightCount[b] == 0) continue;
+            float cost = acc.surfaceArea() * n + rightArea[b] * rightCount[b];
+            if (cost < outCost) {
+                outCost = cost;
+                outAxis = axis;
+                outPos = lo + width * static_cast<float>(b);
+                outLeftCount = n;
+                outRightCount = rightCount[b];
+            }
+        }
+    }
+    return outAxis >= 0;
+}
+
+void BVH::build_sbvh() {
+    std::vector<bvhTri> refs;
+    refs.swap(primitives);
+
+    AABB rootBounds;
+    for (const auto& r : refs)
+        rootBounds.expand(r.bounds);
+
+    int duplicationBudget = static_cast<int>(settings.sbvhMaxDuplication * static_cast<float>(refs.size()));
+    primitives.reserve(refs.size() + static_cast<size_t>(std::max(0, duplicationBudget)));
+    build_sbvh_recursive(refs, duplicationBudget, rootBounds.surfaceArea());
+}
+
+int BVH::build_sbvh_recursive(std::vector<bvhTri>& refs, int& duplicationBudget, float rootArea) {
+    AABB bounds;
+    AABB centroidBounds;
+    for (const auto& r : refs) {
+        bounds.expand(r.bounds);
+        centroidBounds.expand(r.centroid);
+    }
+
+    int nodeIndex = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+    nodes[nodeIndex].bounds = bounds;
+
+    const int nRefs = static_cast<int>(refs.size());
+    const int nBins = std::max(2, settings.sahBins);
+    const float area = bounds.surfaceArea();
+
+    std::vector<bvhTri> left, right;
+    float bestCost = std::numeric_limits<float>::infinity();
+
+    // object split, as in partitionSAH
+    int objAxis, objBin;
+    float objCost;
+    if (nRefs > 1 && findBinnedSplit(refs.data(), nRefs, centroidBounds, nBins, objAxis, objBin, objCost)) {
+        bestCost = objCost;
+        float cmin = centroidBounds.bmin[objAxis];
+        float scale = static_cast<float>(nBins) / (centroidBounds.bmax[objAxis] - cmin);
+        for (const auto& r : refs)
+            (sahBinIndex(r.centroid[objAxis], cmin, scale, nBins) < objBin ? left : right).push_back(r);
+    }
+
+    // spatial split, only where the object split children overlap noticeably and the budget allows
+    if (nRefs > 1 && duplicationBudget > 0 && rootArea > 0.0f) {
+        AABB leftBounds, rightBounds;
+        for (const auto& r : left) leftBounds.expand(r.bounds);
+        for (const auto& r : right) rightBounds.expand(r.bounds);
+        float overlap = left.empty() ? area : overlapBox(leftBounds, rightBounds).surfaceArea();
+
+        int axis = 0, leftCount = 0, rightCount = 0;
+        float pos = 0.0f, cost = std::numeric_limits<float>::infinity();
+        if (overlap / rootArea > settings.sbvhOverlapThreshold &&
+            findSpatialSplit(refs, bounds, nBins, axis, pos, cost, leftCount, rightCount) &&
+            cost < bestCost && leftCount + rightCount - nRefs <= duplicationBudget) {
+            bestCost = cost;
+            left.clear();
+            right.clear();
+            for (const auto& r : refs) {
+                if (r.bounds.bmax[axis] <= pos) {
+                    left.push_back(r);
+                } else if (r.bounds.bmin[axis] >= pos) {
+                    right.push_back(r);
+                } else {
+                    AABB lb = clipReference(r, axis, r.bounds.bmin[axis], pos);
+                    AABB rb = clipReference(r, axis, pos, r.bounds.bmax[axis]);
+                    // clipping can round a sliver away; keep the reference whole on the other side then
+                    bool hasLeft = glm::all(glm::lessThanEqual(lb.bmin, lb.bmax));
+                    bool hasRight = glm::all(glm::lessThanEqual(rb.bmin, rb.bmax));
+                    if (hasLeft) { left.push_back(r); setReferenceBounds(left.back(), hasRight ? lb : r.bounds); }
+                    if (hasRight) { right.push_back(r); setReferenceBounds(right.back(), hasLeft ? rb : r.bounds); }
+                }
+            }
+            duplicationBudget -= static_cast<int>(left.size() + right.size()) - nRefs;
+        }
+    }
+
+    bool makeLeaf = nRefs <= 1;
+    if (!makeLeaf && nRefs <= settings.maxLeafSize)
+        makeLeaf = left.empty() || right.empty() || area <= 0.0f ||
+            settings.intersectCost * nRefs <= settings.traversalCost + settings.intersectCost * bestCost / area;
+    if (!makeLeaf && (left.empty() || right.empty())) {
+        // no usable plane (coincident centroids): halve the list
+        left.assign(refs.begin(), refs.begin() + nRefs / 2);
+        right.assign(refs.begin() + nRefs / 2, refs.end());
+    }
+
+    if (makeLeaf) {
+        nodes[nodeIndex].offset = static_cast<int>(primitives.size());
+        nodes[nodeIndex].count = nRefs;
+        primitives.insert(primitives.end(), refs.begin(), refs.end());
+        return nodeIndex;
+    }
+
+    // release this level's list before descending
+    std::vector<bvhTri>().swap(refs);
+    build_sbvh_recursive(left, duplicationBudget, rootArea);
+    int rightIndex = build_sbvh_recursive(right, duplicationBudget, rootArea);
+    nodes[nodeIndex].offset = rightIndex;
+    return nodeIndex;
+}
+
+namespace {
+
+int popCount(int s) {
+    int n = 0;
+    for (; s; s &= s - 1) ++n;
+    return n;
+}
+
+int lowestBit(int s) {
+    int i = 0;
+    while (!(s & (1 << i))) ++i;
+    return i;
+}
+
+// Explicit-child view of the tree while treelets are reshaped. Nodes keep their array slots, so the
+// depth-first order is only restored at the end. A collapsed node keeps its subtree for bookkeeping
+// but becomes one leaf holding every primitive below it.
+struct TreeletOptimizer {
+    std::vector<BVHNode>& nodes;
+    std::vector<int> left, right;   // -1 for leaves
+    std::vector<char> collapsed;
+    std::vector<float> cost;        // subtree SAH cost, weighted by absolute surface area
+    std::vector<int> primCount;     // primitives below each node
+    int maxLeaves;
+    int maxLeafSize;
+    float traversalCost;
+    float intersectCost;
+    int parallelThreshold;
+
+    TreeletOptimizer(std::vector<BVHNode>& n, const BVHBuildSettings& s)
+        : nodes(n)
+        , left(n.size(), -1)
+        , right(n.size(), -1)
+        , collapsed(n.size(), 0)
+        , cost(n.size(), 0.0f)
+        , primCount(n.size(), 0)
+        , maxLeaves(std::min(std::max(s.treeletLeaves, 3), 8))
+        , maxLeafSize(s.maxLeafSize)
+        , traversalCost(s.traversalCost)
+        , intersectCost(s.intersectCost)
+        , parallelThreshold(s.parallelThreshold) {
+        for (int i = static_cast<int>(n.size()) - 1; i >= 0; --i) {
+            const BVHNode& node = n[i];
+            if (node.isLeaf()) {
+                primCount[i] = node.count;
+                cost[i] = intersectCost * node.count * node.bounds.surfaceArea();
+            } else {
+                left[i] = i + 1;
+                right[i] = node.offset;
+                primCount[i] = primCount[i + 1] + primCount[node.offset];
+                cost[i] = traversalCost * node.bounds.surfaceArea() + cost[i + 1] + cost[node.offset];
+            }
+        }
+    }
+
+    bool isLeaf(int node) const {
+        return left[node] < 0 || collapsed[node];
+    }
+
+    // children first, so every treelet is formed from already optimized subtrees
+    void optimize(int node, ThreadPool* pool) {
+        if (isLeaf(node)) return;
+        if (pool && primCount[node] > parallelThreshold) {
+            TaskGroup group(*pool);
+            group.run([this, node, pool] { optimize(left[node], pool); });
+            optimize(right[node], pool);
+            group.wait();
+        } else {
+            optimize(left[node], nullptr);
+            optimize(right[node], nullptr);
+        }
+        cost[node] = traversalCost * nodes[node].bounds.surfaceArea() + cost[left[node]] + cost[right[node]];
+        restructure(node);
+    }
+
+    // Grows a treelet below root by repeatedly opening its largest interior leaf, finds the cheapest
+    // binary tree over its leaves by dynamic programming over leaf subsets (any subset with few enough
+    // primitives may also become a single leaf), and rewires the treelet's interior nodes into it if
+    // that is cheaper.
+    void restructure(int root) {
+        int leaves[8];
+        int internal[7];
+        int nLeaves = 0;
+        int nInternal = 0;
+        internal[nInternal++] = root;
+        leaves[nLeaves++] = left[root];
+        leaves[nLeaves++] = right[root];
+        while (nLeaves < maxLeaves) {
+            int open = -1;
+            float bestArea = -1.0f;
+            for (int i = 0; i < nLeaves; ++i) {
+                if (isLeaf(leaves[i])) continue;
+                float area = nodes[leaves[i]].bounds.surfaceArea();
+                if (area > bestArea) {
+                    bestArea = area;
+                    open = i;
+                }
+            }
+            if (open < 0) break;
+            int opened = leaves[open];
+            internal[nInternal++] = opened;
+            leaves[open] = left[opened];
+            leaves[nLeaves++] = right[opened];
+        }
+        if (nLeaves < 3) return; // two leaves have only one topology
+
+        const int full = (1 << nLeaves) - 1;
+        AABB boxes[256];
+        float best[256];
+        unsigned char split[256];
+        bool collapse[256];
+        int prims[256];
+        prims[0] = 0;
+        for (int s = 1; s <= full; ++s) {
+            int low = lowestBit(s);
+            boxes[s] = boxes[s & (s - 1)];
+            boxes[s].expand(nodes[leaves[low]].bounds);
+            prims[s] = prims[s & (s - 1)] + primCount[leaves[low]];
+            collapse[s] = false;
+            if ((s & (s - 1)) == 0) {
+                best[s] = cost[leaves[low]];
+                continue;
+            }
+            // every partition once: the left part always holds the lowest leaf
+            float bestSplit = std::numeric_limits<float>::infinity();
+            for (int p = (s - 1) & s; p; p = (p - 1) & s) {
+                if (!(p & (1 << low))) continue;
+                float c = best[p] + best[s ^ p];
+                if (c < bestSplit) {
+                    bestSplit = c;
+                    split[s] = static_cast<unsigned char>(p);
+                }
+            }
+            best[s] = traversalCost * boxes[s].surfaceArea() + bestSplit;
+            if (prims[s] <= maxLeafSize) {
+                float leafCost = intersectCost * prims[s] * boxes[s].surfaceArea();
+                if (leafCost < best[s]) {
+                    best[s] = leafCost;
+                    collapse[s] = true;
+                }
+            }
+        }
+        if (best[full] >= cost[root] * (1.0f - 1e-6f)) return;
+
+        int next = 1;
+        rewire(full, root, leaves, internal, next, boxes, best, split, collapse);
+    }
+
+    void rewire(int s, int node, const int* leaves, const int* internal, int& next,
+        const AABB* boxes, const float* best, const unsigned char* split, const bool* collapse) {
+        int parts[2] = { split[s], s ^ split[s] };
+        int children[2];
+        for (int c = 0; c < 2; ++c) {
+            if (popCount(parts[c]) == 1) {
+                children[c] = leaves[lowestBit(parts[c])];
+            } else {
+                children[c] = internal[next++];
+                rewire(parts[c], children[c], leaves, internal, next, boxes, best, split, collapse);
+            }
+        }
+        left[node] = children[0];
+        right[node] = children[1];
+        collapsed[node] = collapse[s];
+        nodes[node].bounds = boxes[s];
+        cost[node] = best[s];
+        primCount[node] = primCount[children[0]] + primCount[children[1]];
+    }
+
+    // Emits the subtree depth-first, with leaf primitives copied in the same order
+    int linearize(int node, const std::vector<bvhTri>& prims, std::vector<BVHNode>& out, std::vector<bvhTri>& outPrims) const {
+        int index = static_cast<int>(out.size());
+        out.push_back(nodes[node]);
+        if (isLeaf(node)) {
+            out[index].offset = static_cast<int>(outPrims.size());
+            gatherPrimitives(node, prims, outPrims);
+            out[index].count = static_cast<int>(outPrims.size()) - out[index].offset;
+        } else {
+            out[index].count = 0;
+            linearize(left[node], prims, out, outPrims);
+            int r = linearize(right[node], prims, out, outPrims);
+            out[index].offset = r;
+        }
+        return index;
+    }
+
+    void gatherPrimitives(int node, const std::vector<bvhTri>& prims, std::vector<bvhTri>& outPrims) const {
+        if (left[node] < 0) {
+            const BVHNode& n = nodes[node];
+            outPrims.insert(outPrims.end(), prims.begin() + n.offset, prims.begin() + n.offset + n.count);
+        } else {
+            gatherPrimitives(left[node], prims, outPrims);
+            gatherPrimitives(right[node], prims, outPrims);
+        }
+    }
+};
+
+} // namespace
+
+void BVH::optimizeTreelets() {
+    if (nodes.size() < 5) return;
+    auto start = std::chrono::high_resolution_clock::now();
+    float before = computeSAHCost();
+
+    std::shared_ptr<ThreadPool> pool = (settings.buildThreads == 1 || static_cast<int>(primitives.size()) <= settings.parallelThreshold)
+        ? nullptr : sharedBuildPool(settings.buildThreads);
+    TreeletOptimizer opt(nodes, settings);
+    for (int pass = 0; pass < settings.treeletPasses; ++pass)
+        opt.optimize(0, pool.get());
+
+    std::vector<BVHNode> ordered;
+    std::vector<bvhTri> orderedPrims;
+    ordered.reserve(nodes.size());
+    orderedPrims.reserve(primitives.size());
+    opt.linearize(0, primitives, ordered, orderedPrims);
+    nodes.swap(ordered);
+    primitives.swap(orderedPrims);
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "BVH treelet optimization: SAH cost " << before << " -> " << computeSAHCost() << " ("
+        << settings.treeletPasses << " passes, " << ms << " ms)" << std::endl;
+}
+
+// Front to back: both children are slab-tested at their parent and the nearer one is visited first,
+// so the closest hit is usually found early and cuts off the rest through ray.tmax.
 bool BVH::intersectNearest(const Ray& r, float& out_t, int& out_triIdx, float& out_u, float& out_v) const {
     if (nodes.empty()) return false;
-    std::vector<int> stack; stack.reserve(64);
-    stack.push_back(0);
+    float tnear, tfar;
+    if (!nodes[0].bounds.intersectAABB(r, tnear, tfar)) return false;
+
+    struct Entry {
+        int node;
+        float t; // entry distance into the node's box
+    };
+    TraversalStack<Entry, 64> stack(traversalStackSize());
+    int sp = 0;
+    stack[sp++] = { 0, tnear };
     bool hit = false;
-    float nearestT = r.tmax;
+    Ray ray = r;
     int nearestTri = -1;
     float hitu = 0.0f, hitv = 0.0f;
 
-    while (!stack.empty()) {
-        int nodeIdx = stack.back(); stack.pop_back();
-        const BVHNode& node = nodes[nodeIdx];
-        float tnear, tfar;
-        if (!intersectAABB(node.bounds, r.o, r.d, r.tmin, nearestT, tnear, tfar)) continue;
-        if (node.left == -1 && node.right == -1) {
+    while (sp > 0) {
+        Entry e = stack[--sp];
+        if (e.t > ray.tmax) continue; // a closer hit was found after this node was pushed
+        const BVHNode& node = nodes[e.node];
+        if (node.isLeaf()) {
             for (int i = 0; i < node.count; ++i) {
-                int idx = node.start + i;
-                const bvhTri& tri = primitives[idx];
+                int idx = node.offset + i;
                 float t, u, v;
-                if (intersectTriangle(r, tri, t, u, v)) {
-                    if (t < nearestT) {
-                        nearestT = t; nearestTri = idx; hit = true; hitu = u; hitv = v;
-                    }
+                if (bvhTri::intersectTriangle(ray, primitives[idx], t, u, v)) {
+                    // intersectTriangle only accepts t < ray.tmax, so this is the new nearest hit
+                    ray.tmax = t; nearestTri = idx; hit = true; hitu = u; hitv = v;
                 }
             }
-        } else {
-            if (node.left != -1) stack.push_back(node.left);
-            if (node.right != -1) stack.push_back(node.right);
+            continue;
+        }
+
+        // push the farther child first so the nearer one is popped next
+        Entry a = { e.node + 1, 0.0f }, b = { node.offset, 0.0f };
+        bool hitA = nodes[a.node].bounds.intersectAABB(ray, a.t, tfar);
+        bool hitB = nodes[b.node].bounds.intersectAABB(ray, b.t, tfar);
+        if (hitA && hitB) {
+            if (a.t < b.t) std::swap(a, b);
+            stack[sp++] = a;
+            stack[sp++] = b;
+        } else if (hitA) {
+            stack[sp++] = a;
+        } else if (hitB) {
+            stack[sp++] = b;
         }
     }
 
-    if (hit) { out_t = nearestT; out_triIdx = nearestTri; out_u = hitu; out_v = hitv; }
+    if (hit) { out_t = ray.tmax; out_triIdx = nearestTri; out_u = hitu; out_v = hitv; }
     return hit;
-}
-*/
\ No newline at end of file
+}
\ No newline at end of file
@@ -0,0 +1,427 @@
+#include "BVHCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+ContentHash::ContentHash()
+    : m_State(14695981039346656037ull) {}
+
+void ContentHash::add(const void* data, size_t bytes)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < bytes; ++i) {
+        m_State ^= p[i];
+        m_State *= 1099511628211ull;
+    }
+}
+
+void ContentHash::addString(const std::string& s)
+{
+    addValue(static_cast<uint64_t>(s.size()));
+    add(s.data(), s.size());
+}
+
+bool ContentHash::addFile(const std::string& path)
+{
+    addString(path);
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    char buffer[1 << 16];
+    while (in) {
+        in.read(buffer, sizeof(buffer));
+        add(buffer, static_cast<size_t>(in.gcount()));
+    }
+    return true;
+}
+
+MappedFile::MappedFile()
+    : m_Data(nullptr)
+    , m_Size(0)
+#ifdef _WIN32
+    , m_File(nullptr)
+    , m_Mapping(nullptr)
+#else
+    , m_File(-1)
+#endif
+{}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+bool MappedFile::open(const std::string& path)
+{
+    close();
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    m_File = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        close();
+        return false;
+    }
+    m_Mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_Mapping) {
+        close();
+        return false;
+    }
+    m_Data = static_cast<const unsigned char*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m_Data) {
+        close();
+        return false;
+    }
+    m_Size = static_cast<size_t>(size.QuadPart);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (m_Data) UnmapViewOfFile(m_Data);
+    if (m_Mapping) CloseHandle(m_Mapping);
+    if (m_File) CloseHandle(m_File);
+    m_Data = nullptr;
+    m_Mapping = m_File = nullptr;
+    m_Size = 0;
+}
+#else
+bool MappedFile::open(const std::string& path)
+{
+    close();
+    m_File = ::open(path.c_str(), O_RDONLY);
+    if (m_File < 0) return false;
+
+    struct stat st;
+    if (fstat(m_File, &st) != 0 || st.st_size == 0) {
+        close();
+        return false;
+    }
+    void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, m_File, 0);
+    if (p == MAP_FAILED) {
+        close();
+        return false;
+    }
+    m_Data = static_cast<const unsigned char*>(p);
+    m_Size = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (m_Data) munmap(const_cast<unsigned char*>(m_Data), m_Size);
+    if (m_File >= 0) ::close(m_File);
+    m_Data = nullptr;
+    m_File = -1;
+    m_Size = 0;
+}
+#endif
+
+namespace {
+
+const char kMagic[8] = { 'E', 'R', 'T', 'B', 'V', 'H', 'C', '1' };
+const uint32_t kVersion = 3;
+const size_t kAlignment = 16;
+
+enum : uint32_t {
+    SectionGeometries = 1,  // CachedGeometry per geometry
+    SectionInstances,       // CachedInstance per instance
+    SectionPrimitives,      // bvhTri, every geometry back to back in BVH order
+    SectionNodes,           // BVHNode, every geometry back to back (GPUScene::nodes)
+    SectionTriangles,       // packed Triangle (GPUScene::triangles)
+    SectionMaterials        // Material (Scene::materials)
+};
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t sectionCount;
+    uint64_t key;
+};
+
+struct CacheSection {
+    uint32_t id;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t bytes;
+};
+
+struct CachedGeometry {
+    int32_t nodeCount;
+    int32_t primitiveCount;
+    int32_t inputPrimitiveCount;
+    int32_t reserved;
+    BVHBuildSettings settings;
+};
+
+struct CachedInstance {
+    int32_t geometry;
+    int32_t reserved[3];
+    glm::mat4 objectToWorld;
+};
+
+// a section written from one or more separate arrays
+struct SectionData {
+    uint32_t id;
+    std::vector<std::pair<const void*, size_t>> pieces;
+
+    size_t bytes() const {
+        size_t n = 0;
+        for (const auto& p : pieces) n += p.second;
+        return n;
+    }
+};
+
+size_t alignUp(size_t v) {
+    return (v + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+// Child indices and leaf ranges must stay inside their own geometry before BVH::restore walks the
+// nodes. A right child comes after the left child (i + 1), which also rules out cycles.
+bool nodesInRange(const BVHNode* nodes, int nodeCount, int primitiveCount) {
+    for (int i = 0; i < nodeCount; ++i) {
+        const BVHNode& n = nodes[i];
+        if (n.count < 0) return false;
+        if (n.isLeaf() ? n.offset < 0 || n.offset > primitiveCount - n.count
+                       : n.offset <= i + 1 || n.offset >= nodeCount)
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+BVHCache::BVHCache() = default;
+
+uint64_t BVHCache::sceneKey(const std::vector<SceneModelDesc>& models, const BVHBuildSettings& settings)
+{
+    ContentHash h;
+    h.add(kMagic, sizeof(kMagic));
+    h.addValue(kVersion);
+    // any change to the stored layouts invalidates old files
+    h.addValue(static_cast<uint32_t>(sizeof(BVHNode)));
+    h.addValue(static_cast<uint32_t>(sizeof(bvhTri)));
+    h.addValue(static_cast<uint32_t>(sizeof(Triangle)));
+    h.addValue(static_cast<uint32_t>(sizeof(Material)));
+    h.addValue(static_cast<uint32_t>(sizeof(BVHBuildSettings)));
+    // only the settings that shape the tree; thread count, parallel threshold and the refit limit
+    // change how or when it is built, not what comes out
+    h.addValue(static_cast<int32_t>(settings.method));
+    h.addValue(settings.maxLeafSize);
+    h.addValue(settings.sahBins);
+    h.addValue(settings.traversalCost);
+    h.addValue(settings.intersectCost);
+    h.addValue(settings.mortonBits);
+    h.addValue(settings.sbvhMaxDuplication);
+    h.addValue(settings.sbvhOverlapThreshold);
+    h.addValue(settings.treeletPasses);
+    h.addValue(settings.treeletLeaves);
+    for (const auto& m : models) {
+        h.addFile(m.path);
+        h.addValue(m.albedo);
+        h.addValue(m.emission);
+        h.addValue(m.objectToWorld);
+    }
+    return h.value();
+}
+
+bool BVHCache::save(const std::string& path, uint64_t key, const Scene& scene, const GPUScene& gpuScene)
+{
+    // the packed mirrors are only filled by GPUScene::upload(scene)
+    if (gpuScene.triangles.empty() || gpuScene.nodes.empty()) return false;
+
+    std::vector<CachedGeometry> geometries;
+    for (const auto& g : scene.geometries) {
+        CachedGeometry cg;
+        cg.nodeCount = static_cast<int32_t>(g.nodes.size());
+        cg.primitiveCount = static_cast<int32_t>(g.primitives.size());
+        cg.inputPrimitiveCount = g.inputPrimitiveCount;
+        cg.reserved = 0;
+        cg.settings = g.settings;
+        geometries.push_back(cg);
+    }
+    std::vector<CachedInstance> instances;
+    for (const auto& inst : scene.instances) {
+        CachedInstance ci = {};
+        ci.geometry = inst.geometry;
+        ci.objectToWorld = inst.objectToWorld;
+        instances.push_back(ci);
+    }
+
+    std::vector<SectionData> sections(6);
+    sections[0].id = SectionGeometries;
+    sections[0].pieces.emplace_back(geometries.data(), geometries.size() * sizeof(CachedGeometry));
+    sections[1].id = SectionInstances;
+    sections[1].pieces.emplace_back(instances.data(), instances.size() * sizeof(CachedInstance));
+    sections[2].id = SectionPrimitives;
+    for (const auto& g : scene.geometries)
+        sections[2].pieces.emplace_back(g.primitives.data(), g.primitives.size() * sizeof(bvhTri));
+    sections[3].id = SectionNodes;
+    sections[3].pieces.emplace_back(gpuScene.nodes.data(), gpuScene.nodes.size() * sizeof(BVHNode));
+    sections[4].id = SectionTriangles;
+    sections[4].pieces.emplace_back(gpuScene.triangles.data(), gpuScene.triangles.size() * sizeof(Triangle));
+    sections[5].id = SectionMaterials;
+    sections[5].pieces.emplace_back(scene.materials.data(), scene.materials.size() * sizeof(Material));
+
+    CacheHeader header;
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.sectionCount = static_cast<uint32_t>(sections.size());
+    header.key = key;
+
+    std::vector<CacheSection> table;
+    size_t offset = alignUp(sizeof(CacheHeader) + sections.size() * sizeof(CacheSection));
+    for (const auto& s : sections) {
+        CacheSection entry;
+        entry.id = s.id;
+        entry.reserved = 0;
+        entry.offset = offset;
+        entry.bytes = s.bytes();
+        table.push_back(entry);
+        offset = alignUp(offset + s.bytes());
+    }
+
+    // write next to the target and swap it in, so a failed write never leaves a damaged cache behind
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        const char zeros[kAlignment] = {};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(CacheSection));
+        size_t written = sizeof(header) + table.size() * sizeof(CacheSection);
+        for (size_t i = 0; i < sections.size(); ++i) {
+            out.write(zeros, table[i].offset - written);
+            for (const auto& piece : sections[i].pieces)
+                out.write(static_cast<const char*>(piece.first), piece.second);
+            written = table[i].offset + table[i].bytes;
+        }
+        if (!out) {
+            out.close();
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+    }
+    std::remove(path.c_str());
+    return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+bool BVHCache::open(const std::string& path, uint64_t key)
+{
+    if (!m_File.open(path)) return false;
+
+    const unsigned char* data = m_File.data();
+    size_t size = m_File.size();
+    bool valid = size >= sizeof(CacheHeader);
+    const CacheHeader* header = reinterpret_cast<const CacheHeader*>(data);
+    valid = valid && std::memcmp(header->magic, kMagic, sizeof(kMagic)) == 0 &&
+        header->version == kVersion && header->key == key &&
+        sizeof(CacheHeader) + static_cast<size_t>(header->sectionCount) * sizeof(CacheSection) <= size;
+    if (valid) {
+        const CacheSection* table = reinterpret_cast<const CacheSection*>(data + sizeof(CacheHeader));
+        for (uint32_t i = 0; i < header->sectionCount; ++i)
+            valid = valid && table[i].offset % kAlignment == 0 && table[i].offset <= size &&
+                table[i].bytes <= size - table[i].offset;
+    }
+
+    // section sizes must agree with the geometry table
+    if (valid) {
+        size_t geomBytes, instBytes, primBytes, nodeBytes, triBytes, materialBytes;
+        const CachedGeometry* geoms = static_cast<const CachedGeometry*>(section(SectionGeometries, geomBytes));
+        valid = geoms && section(SectionInstances, instBytes) && section(SectionPrimitives, primBytes) &&
+            section(SectionNodes, nodeBytes) && section(SectionTriangles, triBytes) &&
+            section(SectionMaterials, materialBytes) && geomBytes % sizeof(CachedGeometry) == 0 &&
+            instBytes % sizeof(CachedInstance) == 0 && materialBytes % sizeof(Material) == 0;
+        if (valid) {
+            size_t nodeCount = 0, primCount = 0;
+            for (size_t i = 0; i < geomBytes / sizeof(CachedGeometry); ++i) {
+                valid = valid && geoms[i].nodeCount >= 0 && geoms[i].primitiveCount >= 0;
+                nodeCount += static_cast<size_t>(geoms[i].nodeCount);
+                primCount += static_cast<size_t>(geoms[i].primitiveCount);
+            }
+            valid = valid && nodeBytes == nodeCount * sizeof(BVHNode) &&
+                primBytes == primCount * sizeof(bvhTri) && triBytes == primCount * sizeof(Triangle);
+            const BVHNode* nodes = static_cast<const BVHNode*>(section(SectionNodes, nodeBytes));
+            for (size_t i = 0; valid && i < geomBytes / sizeof(CachedGeometry); ++i) {
+                valid = nodesInRange(nodes, geoms[i].nodeCount, geoms[i].primitiveCount);
+                nodes += geoms[i].nodeCount;
+            }
+            const CachedInstance* insts = static_cast<const CachedInstance*>(section(SectionInstances, instBytes));
+            for (size_t i = 0; i < instBytes / sizeof(CachedInstance); ++i)
+                valid = valid && insts[i].geometry >= 0 &&
+                    static_cast<size_t>(insts[i].geometry) < geomBytes / sizeof(CachedGeometry);
+        }
+    }
+
+    if (!valid) {
+        std::cout << "BVH cache " << path << " is stale or damaged, rebuilding" << std::endl;
+        m_File.close();
+    }
+    return valid;
+}
+
+void BVHCache::close()
+{
+    m_File.close();
+}
+
+const void* BVHCache::section(uint32_t id, size_t& bytes) const
+{
+    const CacheHeader* header = reinterpret_cast<const CacheHeader*>(m_File.data());
+    const CacheSection* table = reinterpret_cast<const CacheSection*>(m_File.data() + sizeof(CacheHeader));
+    for (uint32_t i = 0; i < header->sectionCount; ++i) {
+        if (table[i].id == id) {
+            bytes = static_cast<size_t>(table[i].bytes);
+            return m_File.data() + table[i].offset;
+        }
+    }
+    bytes = 0;
+    return nullptr;
+}
+
+void BVHCache::restore(Scene& scene) const
+{
+    size_t geomBytes, instBytes, primBytes, nodeBytes, materialBytes;
+    const CachedGeometry* geoms = static_cast<const CachedGeometry*>(section(SectionGeometries, geomBytes));
+    const CachedInstance* insts = static_cast<const CachedInstance*>(section(SectionInstances, instBytes));
+    const bvhTri* prims = static_cast<const bvhTri*>(section(SectionPrimitives, primBytes));
+    const BVHNode* nodes = static_cast<const BVHNode*>(section(SectionNodes, nodeBytes));
+    const Material* materials = static_cast<const Material*>(section(SectionMaterials, materialBytes));
+
+    scene.materials.assign(materials, materials + materialBytes / sizeof(Material));
+    for (size_t i = 0; i < geomBytes / sizeof(CachedGeometry); ++i) {
+        const CachedGeometry& g = geoms[i];
+        BVH blas;
+        blas.restore(std::vector<BVHNode>(nodes, nodes + g.nodeCount),
+                     std::vector<bvhTri>(prims, prims + g.primitiveCount),
+                     g.inputPrimitiveCount, g.settings);
+        scene.addGeometry(std::move(blas));
+        nodes += g.nodeCount;
+        prims += g.primitiveCount;
+    }
+    for (size_t i = 0; i < instBytes / sizeof(CachedInstance); ++i)
+        scene.addInstance(insts[i].geometry, insts[i].objectToWorld);
+    scene.buildTopLevel();
+}
+
+void BVHCache::upload(const Scene& scene, GPUScene& gpuScene) const
+{
+    size_t bytes;
+    const Triangle* triangles = static_cast<const Triangle*>(section(SectionTriangles, bytes));
+    const BVHNode* nodes = static_cast<const BVHNode*>(section(SectionNodes, bytes));
+    gpuScene.upload(scene, triangles, nodes);
+}
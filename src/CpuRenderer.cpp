@@ -0,0 +1,233 @@
+#include "CpuRenderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "RayPacket.h"
+
+namespace {
+
+// Port of the shader's hash RNG; all arithmetic wraps like GLSL uint
+uint32_t hash(uint32_t x, uint32_t y, uint32_t z) {
+    x = x * 1664525u + 1013904223u;
+    y = y * 1664525u + 1013904223u;
+    z = z * 1664525u + 1013904223u;
+    x += y * z; y += z * x; z += x * y;
+    x ^= x >> 16u;
+    x += x << 3u;
+    x ^= x >> 4u;
+    x *= 0x27d4eb2du;
+    x ^= x >> 15u;
+    return x;
+}
+
+float maxComponent(const glm::vec3& c) {
+    return std::max(c.r, std::max(c.g, c.b));
+}
+
+glm::vec3 cosineSampleHemisphere(float u1, float u2) {
+    float r = std::sqrt(u1);
+    float theta = 6.2831853f * u2;
+    return glm::vec3(r * std::cos(theta), r * std::sin(theta), std::sqrt(std::max(0.0f, 1.0f - u1)));
+}
+
+glm::mat3 basisFromNormal(const glm::vec3& n) {
+    glm::vec3 w = glm::normalize(n);
+    glm::vec3 a = std::abs(w.z) < 0.999f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+    glm::vec3 v = glm::normalize(glm::cross(w, a));
+    glm::vec3 u = glm::cross(v, w);
+    return glm::mat3(u, v, w);
+}
+
+// object-space normal to world space: transpose of world-to-object
+glm::vec3 transformNormal(const Instance& inst, const glm::vec3& n) {
+    return glm::transpose(glm::mat3(inst.worldToObject)) * n;
+}
+
+} // namespace
+
+CpuRenderer::CpuRenderer(int numThreads)
+    : m_Pool(numThreads) {}
+
+float CpuRenderer::Rng::next()
+{
+    uint32_t nx = hash(x, y, z), ny = hash(y, x, z), nz = hash(z, x, y);
+    x = nx; y = ny; z = nz;
+    return static_cast<float>(x) / 4294967296.0f;
+}
+
+glm::vec3 CpuRenderer::toneMap(const glm::vec3& radiance)
+{
+    glm::vec3 c = radiance / (glm::vec3(1.0f) + radiance);
+    return glm::pow(c, glm::vec3(1.0f / 2.2f));
+}
+
+void CpuRenderer::render(const Scene& scene, const glm::vec3& camPos, const glm::mat4& invViewProj,
+                         const CpuRenderSettings& settings, std::vector<glm::vec3>& outRadiance)
+{
+    outRadiance.assign(static_cast<size_t>(settings.width) * settings.height, glm::vec3(0.0f));
+    m_Lights.build(scene);
+    m_LightTree.build(m_Lights);
+
+    TileScheduler scheduler(settings.width, settings.height, settings.tileSize);
+    scheduler.run(m_Pool, [&](const Tile& tile) {
+        for (int y = tile.y0; y < tile.y1; ++y)
+            for (int x = tile.x0; x < tile.x1; x += 8)
+                traceSpan(scene, x, std::min(x + 8, tile.x1), y, camPos, invViewProj, settings,
+                          &outRadiance[static_cast<size_t>(y) * settings.width + x]);
+    });
+    m_TileStats = scheduler.stats();
+}
+
+void CpuRenderer::traceSpan(const Scene& scene, int x0, int x1, int y, const glm::vec3& camPos, const glm::mat4& invViewProj,
+                            const CpuRenderSettings& settings, glm::vec3* out) const
+{
+    const AABB sceneBounds = scene.bounds();
+    const int lanes = x1 - x0;
+    Rng rng[8];
+    glm::vec3 col[8];
+    for (int i = 0; i < lanes; ++i) {
+        rng[i] = { static_cast<uint32_t>(x0 + i) + 4096u * static_cast<uint32_t>(y), static_cast<uint32_t>(settings.frame), 1234567u };
+        col[i] = glm::vec3(0.0f);
+    }
+
+    for (int s = 0; s < settings.spp; ++s) {
+        Ray rays[8];
+        RayPacket8 packet;
+        int active = 0;
+        for (int i = 0; i < lanes; ++i) {
+            rays[i] = cameraRay(rng[i], x0 + i, y, camPos, invViewProj, settings);
+            // early out if outside the scene bounds
+            float tEnter, tExit;
+            if (!sceneBounds.intersectAABB(rays[i], tEnter, tExit) || tExit <= 0.0f)
+                continue;
+            active |= 1 << i;
+            packet.set(i, rays[i]);
+        }
+        if (!settings.primaryPackets) {
+            for (int i = 0; i < lanes; ++i)
+                if (active & (1 << i))
+                    col[i] += tracePath(scene, rays[i], nullptr, rng[i], settings);
+            continue;
+        }
+
+        SceneHit hits[8];
+        int hitMask = IntersectPacket(scene, packet, active, hits);
+        for (int i = 0; i < lanes; ++i) {
+            if (!(active & (1 << i))) continue;
+            if (!(hitMask & (1 << i))) hits[i].instance = -1;
+            col[i] += tracePath(scene, rays[i], &hits[i], rng[i], settings);
+        }
+    }
+
+    for (int i = 0; i < lanes; ++i)
+        out[i] = col[i] / static_cast<float>(settings.spp);
+}
+
+// ray generation via inverse view-projection
+Ray CpuRenderer::cameraRay(Rng& rng, int x, int y, const glm::vec3& camPos, const glm::mat4& invViewProj,
+                           const CpuRenderSettings& settings)
+{
+    const glm::vec2 resolution(static_cast<float>(settings.width), static_cast<float>(settings.height));
+    const glm::vec2 fragCoord(x + 0.5f, y + 0.5f);
+    float jx = rng.next();
+    float jy = rng.next();
+    glm::vec2 ndc = ((fragCoord + glm::vec2(jx, jy)) / resolution) * 2.0f - 1.0f;
+    glm::vec4 nearP = invViewProj * glm::vec4(ndc, -1.0f, 1.0f);
+    nearP /= nearP.w;
+    glm::vec4 farP = invViewProj * glm::vec4(ndc, 1.0f, 1.0f);
+    farP /= farP.w;
+    return Ray(camPos, glm::normalize(glm::vec3(farP) - glm::vec3(nearP)), 1e-4f, 1e30f);
+}
+
+glm::vec3 CpuRenderer::tracePath(const Scene& scene, Ray ray, const SceneHit* primaryHit, Rng& rng,
+                                 const CpuRenderSettings& settings) const
+{
+    const float pi = 3.14159265f;
+    glm::vec3 throughput(1.0f);
+    glm::vec3 L(0.0f);
+
+    for (int depth = 0; depth < settings.maxDepth; ++depth) {
+        SceneHit h;
+        if (depth == 0 && primaryHit) {
+            if (primaryHit->instance < 0)
+                break;
+            h = *primaryHit;
+        } else if (!scene.intersectNearest(ray, h)) {
+            break; // background black
+        }
+        const Instance& inst = scene.instances[h.instance];
+        const bvhTri& T = scene.geometries[inst.geometry].primitives[h.prim];
+        const Material& M = scene.materials[T.material];
+        glm::vec3 hit = ray.o + ray.d * h.t;
+        glm::vec3 N = glm::normalize(transformNormal(inst, glm::cross(T.v1 - T.v0, T.v2 - T.v0)));
+        if (glm::dot(N, ray.d) > 0.0f) N = -N;
+
+        // emission on hit
+        if (M.isEmissive()) {
+            L += throughput * M.emission;
+            break;
+        }
+
+        // next event estimation: one emissive triangle picked by the light tree (or by power alone),
+        // then a uniform point on it
+        float pickProb = 0.0f;
+        int pick = -1;
+        if (m_Lights.count() > 0) {
+            float u = rng.next();
+            if (settings.lightTree) {
+                pick = m_LightTree.sample(hit, N, u, pickProb);
+            } else {
+                pick = m_Lights.sample(u);
+                pickProb = m_Lights.probability[pick];
+            }
+        }
+        if (pick >= 0) {
+            const EmissiveTriangle& LT = m_Lights.lights[pick];
+            const glm::vec3& v0 = LT.v0;
+            const glm::vec3& v1 = LT.v1;
+            const glm::vec3& v2 = LT.v2;
+            float r1 = rng.next();
+            float r2 = rng.next();
+            float su1 = std::sqrt(r1);
+            float b0 = 1.0f - su1;
+            float b1 = r2 * su1;
+            float b2 = 1.0f - b0 - b1;
+            glm::vec3 lp = v0 * b0 + v1 * b1 + v2 * b2;
+            glm::vec3 ln = glm::normalize(glm::cross(v1 - v0, v2 - v0));
+            float pdfL = pickProb / LT.area;
+
+            if (pdfL > 0.0f) {
+                glm::vec3 toL = lp - hit;
+                float dist2 = glm::dot(toL, toL);
+                float dist = std::sqrt(dist2);
+                glm::vec3 wi = toL / dist;
+                float cosS = std::max(0.0f, glm::dot(N, wi));
+                float cosL = std::max(0.0f, glm::dot(ln, -wi));
+
+                // stop short of the light by a relative margin, its own hit drifts with distance at grazing angles
+                bool blocked = scene.occluded(Ray(hit + N * 1e-3f, wi, 1e-4f, dist * 0.999f));
+                if (!blocked && cosS > 0.0f && cosL > 0.0f) {
+                    glm::vec3 brdf = M.albedo / pi;
+                    float G = (cosS * cosL) / dist2;
+                    L += throughput * LT.emission * brdf * G / pdfL;
+                }
+            }
+        }
+
+        // cosine-weighted diffuse bounce; brdf * cos / pdf reduces to the albedo
+        float u1 = rng.next();
+        float u2 = rng.next();
+        glm::vec3 newDir = glm::normalize(basisFromNormal(N) * cosineSampleHemisphere(u1, u2));
+        throughput *= M.albedo;
+
+        // Russian roulette
+        float p = std::min(std::max(maxComponent(throughput), 0.1f), 0.95f);
+        if (rng.next() > p) break;
+        throughput /= p;
+
+        ray = Ray(hit + N * 1e-3f, newDir, 1e-4f, 1e30f);
+    }
+    return L;
+}
@@ -0,0 +1,301 @@
+#include "GPUScene.h"
+
+#include <cstring>
+
+// Pack triangles in BVH primitive order: 3 vec4 per triangle for intersection
+static void PackTriangles(const BVH& bvh, int first, int last, std::vector<Triangle>& out)
+{
+    for (int i = first; i < last; ++i) {
+        const bvhTri& t = bvh.primitives[i];
+        out.emplace_back(t.v0, t.v1, t.v2, t.material);
+    }
+}
+
+static float IntBitsToFloat(int i)
+{
+    float f;
+    std::memcpy(&f, &i, sizeof(f));
+    return f;
+}
+
+// (Re)allocates a buffer and the buffer texture viewing it, RGBA32F unless given
+static void UploadBufferTexture(GLuint& buffer, GLuint& tex, const void* data, size_t bytes, GLenum format = GL_RGBA32F)
+{
+    if (!buffer) glGenBuffers(1, &buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(bytes), data, GL_STATIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    if (!tex) glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_BUFFER, tex);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+static void DeleteBufferTexture(GLuint& buffer, GLuint& tex)
+{
+    if (tex) glDeleteTextures(1, &tex);
+    if (buffer) glDeleteBuffers(1, &buffer);
+    tex = buffer = 0;
+}
+
+GPUScene::GPUScene()
+    : useLightTree(true)
+    , useStorageBuffers(false)
+    , instanceCount(0)
+    , traversalStackSize(1)
+    , maxStackSize(64)
+    , m_TriBuffer(0), m_TriTex(0)
+    , m_MaterialBuffer(0), m_MaterialTex(0)
+    , m_NodeBuffer(0), m_NodeTex(0)
+    , m_TLASBuffer(0), m_TLASTex(0)
+    , m_InstanceBuffer(0), m_InstanceTex(0)
+    , m_LightBuffer(0), m_LightTex(0)
+    , m_LightTreeBuffer(0), m_LightTreeTex(0)
+    , m_ParentBuffer(0), m_ParentTex(0)
+    , m_TLASParentBuffer(0), m_TLASParentTex(0)
+    , m_BLASStackSize(1) {}
+
+GPUScene::~GPUScene()
+{
+    DeleteBufferTexture(m_TriBuffer, m_TriTex);
+    DeleteBufferTexture(m_MaterialBuffer, m_MaterialTex);
+    DeleteBufferTexture(m_NodeBuffer, m_NodeTex);
+    DeleteBufferTexture(m_TLASBuffer, m_TLASTex);
+    DeleteBufferTexture(m_InstanceBuffer, m_InstanceTex);
+    DeleteBufferTexture(m_LightBuffer, m_LightTex);
+    DeleteBufferTexture(m_LightTreeBuffer, m_LightTreeTex);
+    DeleteBufferTexture(m_ParentBuffer, m_ParentTex);
+    DeleteBufferTexture(m_TLASParentBuffer, m_TLASParentTex);
+}
+
+void GPUScene::upload(const Scene& scene)
+{
+    triangles.clear();
+    nodes.clear();
+    computeOffsets(scene);
+    for (const auto& g : scene.geometries) {
+        PackTriangles(g, 0, static_cast<int>(g.primitives.size()), triangles);
+        nodes.insert(nodes.end(), g.nodes.begin(), g.nodes.end());
+    }
+
+    UploadBufferTexture(m_TriBuffer, m_TriTex, triangles.data(), triangles.size() * sizeof(Triangle));
+    UploadBufferTexture(m_NodeBuffer, m_NodeTex, nodes.data(), nodes.size() * sizeof(BVHNode));
+    uploadMaterials(scene);
+    uploadParents(scene);
+    uploadTopLevel(scene);
+}
+
+void GPUScene::upload(const Scene& scene, const Triangle* packedTriangles, const BVHNode* packedNodes)
+{
+    triangles.clear();
+    nodes.clear();
+    computeOffsets(scene);
+    size_t triangleCount = 0, nodeCount = 0;
+    for (const auto& g : scene.geometries) {
+        triangleCount += g.primitives.size();
+        nodeCount += g.nodes.size();
+    }
+
+    UploadBufferTexture(m_TriBuffer, m_TriTex, packedTriangles, triangleCount * sizeof(Triangle));
+    UploadBufferTexture(m_NodeBuffer, m_NodeTex, packedNodes, nodeCount * sizeof(BVHNode));
+    uploadMaterials(scene);
+    uploadParents(scene);
+    uploadTopLevel(scene);
+}
+
+// Material texels:
+// 0: albedo.rgb, unused
+// 1: emission.rgb, unused
+void GPUScene::uploadMaterials(const Scene& scene)
+{
+    materialTexels.clear();
+    for (const auto& m : scene.materials) {
+        materialTexels.emplace_back(m.albedo, 0.0f);
+        materialTexels.emplace_back(m.emission, 0.0f);
+    }
+    UploadBufferTexture(m_MaterialBuffer, m_MaterialTex, materialTexels.data(), materialTexels.size() * sizeof(glm::vec4));
+}
+
+// parent links of every bottom-level tree, and the stack the deepest one needs
+void GPUScene::uploadParents(const Scene& scene)
+{
+    nodeParents.clear();
+    m_BLASStackSize = 1;
+    for (const auto& g : scene.geometries) {
+        g.appendParents(nodeParents);
+        m_BLASStackSize = std::max(m_BLASStackSize, g.traversalStackSize());
+    }
+    UploadBufferTexture(m_ParentBuffer, m_ParentTex, nodeParents.data(), nodeParents.size() * sizeof(int), GL_R32I);
+}
+
+// first node and triangle of each geometry in the shared buffers
+void GPUScene::computeOffsets(const Scene& scene)
+{
+    nodeOffsets.clear();
+    primOffsets.clear();
+    int nodeOffset = 0, primOffset = 0;
+    for (const auto& g : scene.geometries) {
+        nodeOffsets.push_back(nodeOffset);
+        primOffsets.push_back(primOffset);
+        nodeOffset += static_cast<int>(g.nodes.size());
+        primOffset += static_cast<int>(g.primitives.size());
+    }
+}
+
+// Instance texels:
+// 0-2: rows of the world-to-object transform
+// 3-5: rows of the object-to-world transform
+// 6:   root node, first triangle, triangle count, unused (integer bits)
+void GPUScene::packTopLevel(const Scene& scene)
+{
+    tlasNodes = scene.tlas.nodes;
+
+    instanceTexels.clear();
+    for (const auto& proxy : scene.tlas.primitives) {
+        const Instance& inst = scene.instances[proxy.id];
+        glm::mat4 w2o = glm::transpose(inst.worldToObject);
+        glm::mat4 o2w = glm::transpose(inst.objectToWorld);
+        for (int r = 0; r < 3; ++r) instanceTexels.push_back(w2o[r]);
+        for (int r = 0; r < 3; ++r) instanceTexels.push_back(o2w[r]);
+        const BVH& g = scene.geometries[inst.geometry];
+        instanceTexels.emplace_back(IntBitsToFloat(nodeOffsets[inst.geometry]),
+                                    IntBitsToFloat(primOffsets[inst.geometry]),
+                                    IntBitsToFloat(static_cast<int>(g.primitives.size())), 0.0f);
+    }
+    instanceCount = static_cast<int>(scene.tlas.primitives.size());
+    bounds = scene.bounds();
+    tlasParents.clear();
+    scene.tlas.appendParents(tlasParents);
+    traversalStackSize = std::max(m_BLASStackSize, scene.tlas.traversalStackSize());
+
+    // Light texels:
+    // 0: v0.xyz, alias threshold
+    // 1: v1.xyz, alias index (integer bits)
+    // 2: v2.xyz, probability of picking this light
+    // 3: emission.rgb, area
+    lights.build(scene);
+    lightTexels.clear();
+    for (int i = 0; i < lights.count(); ++i) {
+        const EmissiveTriangle& e = lights.lights[i];
+        lightTexels.emplace_back(e.v0, lights.threshold[i]);
+        lightTexels.emplace_back(e.v1, IntBitsToFloat(lights.alias[i]));
+        lightTexels.emplace_back(e.v2, lights.probability[i]);
+        lightTexels.emplace_back(e.emission, e.area);
+    }
+    lightTree.build(lights);
+}
+
+void GPUScene::uploadTopLevel(const Scene& scene)
+{
+    packTopLevel(scene);
+    UploadBufferTexture(m_TLASBuffer, m_TLASTex, tlasNodes.data(), tlasNodes.size() * sizeof(BVHNode));
+    UploadBufferTexture(m_InstanceBuffer, m_InstanceTex, instanceTexels.data(), instanceTexels.size() * sizeof(glm::vec4));
+    UploadBufferTexture(m_LightBuffer, m_LightTex, lightTexels.data(), lightTexels.size() * sizeof(glm::vec4));
+    UploadBufferTexture(m_LightTreeBuffer, m_LightTreeTex, lightTree.nodes.data(), lightTree.nodes.size() * sizeof(LightBVHNode));
+    UploadBufferTexture(m_TLASParentBuffer, m_TLASParentTex, tlasParents.data(), tlasParents.size() * sizeof(int), GL_R32I);
+}
+
+void GPUScene::uploadRefit(const Scene& scene, int geometry)
+{
+    const BVH& g = scene.geometries[geometry];
+    int nodeOffset = nodeOffsets[geometry];
+    int primOffset = primOffsets[geometry];
+
+    // node indices are relative to the tree, so changed ranges are copied as they are
+    glBindBuffer(GL_TEXTURE_BUFFER, m_NodeBuffer);
+    for (const auto& range : g.dirtyNodeRanges) {
+        size_t first = static_cast<size_t>(nodeOffset + range.first);
+        if (!nodes.empty())
+            std::copy(g.nodes.begin() + range.first, g.nodes.begin() + range.second, nodes.begin() + first);
+        glBufferSubData(GL_TEXTURE_BUFFER, static_cast<GLintptr>(first * sizeof(BVHNode)),
+            static_cast<GLsizeiptr>((range.second - range.first) * sizeof(BVHNode)), &g.nodes[range.first]);
+    }
+
+    // every vertex of the geometry may have moved
+    std::vector<Triangle> tris;
+    PackTriangles(g, 0, static_cast<int>(g.primitives.size()), tris);
+    if (!triangles.empty())
+        std::copy(tris.begin(), tris.end(), triangles.begin() + primOffset);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_TriBuffer);
+    glBufferSubData(GL_TEXTURE_BUFFER, static_cast<GLintptr>(primOffset * sizeof(Triangle)),
+        static_cast<GLsizeiptr>(tris.size() * sizeof(Triangle)), tris.data());
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+bool GPUScene::storageBuffersSupported()
+{
+    return GLEW_VERSION_4_3 != 0;
+}
+
+std::string GPUScene::shaderDefines() const
+{
+    std::string defines = useStorageBuffers ? "#define SCENE_SSBO\n" : "";
+    if (stackless())
+        defines += "#define BVH_STACKLESS\n";
+    else
+        defines += "#define BVH_STACK_SIZE " + std::to_string(std::min((traversalStackSize + 7) / 8 * 8, maxStackSize)) + "\n";
+    return defines;
+}
+
+void GPUScene::bind(Shader& shader) const
+{
+    if (useStorageBuffers) {
+        // Triangles, bottom-level nodes, top-level nodes and instances on bindings 4-7, as declared
+        // in raytracing_common.glsl
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_TriBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_NodeBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, m_TLASBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, m_InstanceBuffer);
+    } else {
+        // Bind triangle buffer texture to unit 0
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_BUFFER, m_TriTex);
+        shader.SetUniform1i("uTriangles", 0);
+
+        // Bind BVH node buffers to units 1 and 2
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_BUFFER, m_NodeTex);
+        shader.SetUniform1i("uBVHNodes", 1);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_BUFFER, m_TLASTex);
+        shader.SetUniform1i("uTLASNodes", 2);
+
+        // Bind instances to unit 3
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_BUFFER, m_InstanceTex);
+        shader.SetUniform1i("uInstances", 3);
+    }
+    shader.SetUniform1i("uInstanceCount", instanceCount);
+
+    // Bind materials to unit 7 (unit 6 is the accumulation buffer of the fragment path)
+    glActiveTexture(GL_TEXTURE7);
+    glBindTexture(GL_TEXTURE_BUFFER, m_MaterialTex);
+    shader.SetUniform1i("uMaterials", 7);
+
+    // Bind emissive triangles to unit 4
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_BUFFER, m_LightTex);
+    shader.SetUniform1i("uLights", 4);
+    shader.SetUniform1i("uLightCount", lights.count());
+
+    // Bind the light tree to unit 5
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_BUFFER, m_LightTreeTex);
+    shader.SetUniform1i("uLightTree", 5);
+    shader.SetUniform1i("uUseLightTree", useLightTree ? 1 : 0);
+
+    // Parent links on units 8 and 9 for the stackless traversal
+    if (stackless()) {
+        glActiveTexture(GL_TEXTURE8);
+        glBindTexture(GL_TEXTURE_BUFFER, m_ParentTex);
+        shader.SetUniform1i("uBVHParents", 8);
+        glActiveTexture(GL_TEXTURE9);
+        glBindTexture(GL_TEXTURE_BUFFER, m_TLASParentTex);
+        shader.SetUniform1i("uTLASParents", 9);
+    }
+
+    // Scene AABB
+    shader.SetUniform3fv("uSceneMin", bounds.bmin);
+    shader.SetUniform3fv("uSceneMax", bounds.bmax);
+}
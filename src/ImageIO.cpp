@@ -0,0 +1,192 @@
+#include "ImageIO.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+unsigned char ToByte(float c) {
+    return static_cast<unsigned char>(std::min(std::max(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+void PutU32BE(std::vector<unsigned char>& out, uint32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.push_back(static_cast<unsigned char>(v >> shift));
+}
+
+template <typename T>
+void PutLE(std::vector<unsigned char>& out, T v) {
+    unsigned char bytes[sizeof(T)];
+    std::memcpy(bytes, &v, sizeof(T)); // both target platforms are little endian
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+void PutString(std::vector<unsigned char>& out, const char* s) {
+    out.insert(out.end(), s, s + std::strlen(s) + 1);
+}
+
+// EXR header attribute whose value is a single byte enum: name, type, size 1, value
+void PutByteAttribute(std::vector<unsigned char>& out, const char* name, unsigned char value) {
+    PutString(out, name); PutString(out, name); PutLE<int32_t>(out, 1);
+    out.push_back(value);
+}
+
+uint32_t Crc32(const unsigned char* data, size_t size, uint32_t crc = 0) {
+    static uint32_t table[256];
+    static bool initialized = false;
+    if (!initialized) {
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        initialized = true;
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// length, type, data, CRC over type and data
+void PutChunk(std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& data) {
+    PutU32BE(out, static_cast<uint32_t>(data.size()));
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    PutU32BE(out, Crc32(&out[start], out.size() - start));
+}
+
+bool WriteFile(const std::string& path, const std::vector<unsigned char>& bytes) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+    out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    return static_cast<bool>(out);
+}
+
+} // namespace
+
+bool WritePPM(const std::string& path, int width, int height, const std::vector<glm::vec3>& pixels)
+{
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+    out << "P6\n" << width << " " << height << "\n255\n";
+
+    // PPM stores the top row first
+    std::vector<unsigned char> row(static_cast<size_t>(width) * 3);
+    for (int y = height - 1; y >= 0; --y) {
+        for (int x = 0; x < width; ++x) {
+            const glm::vec3& c = pixels[static_cast<size_t>(y) * width + x];
+            for (int k = 0; k < 3; ++k)
+                row[x * 3 + k] = ToByte(c[k]);
+        }
+        out.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size()));
+    }
+    return static_cast<bool>(out);
+}
+
+bool WritePFM(const std::string& path, int width, int height, const std::vector<glm::vec3>& pixels)
+{
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+    // a negative scale marks little-endian data; PFM stores the bottom row first, like the input
+    out << "PF\n" << width << " " << height << "\n-1.0\n";
+    static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "glm::vec3 must be tightly packed");
+    out.write(reinterpret_cast<const char*>(pixels.data()), static_cast<std::streamsize>(pixels.size() * sizeof(glm::vec3)));
+    return static_cast<bool>(out);
+}
+
+bool WritePNG(const std::string& path, int width, int height, const std::vector<glm::vec3>& pixels)
+{
+    // filter type 0 and RGB bytes per row, top row first
+    std::vector<unsigned char> raw;
+    raw.reserve(static_cast<size_t>(height) * (1 + static_cast<size_t>(width) * 3));
+    for (int y = height - 1; y >= 0; --y) {
+        raw.push_back(0);
+        for (int x = 0; x < width; ++x) {
+            const glm::vec3& c = pixels[static_cast<size_t>(y) * width + x];
+            for (int k = 0; k < 3; ++k)
+                raw.push_back(ToByte(c[k]));
+        }
+    }
+
+    // zlib stream of stored deflate blocks (at most 65535 bytes each) and an Adler-32 trailer
+    std::vector<unsigned char> zlib = { 0x78, 0x01 };
+    uint32_t a = 1, b = 0;
+    for (unsigned char byte : raw) {
+        a = (a + byte) % 65521u;
+        b = (b + a) % 65521u;
+    }
+    size_t pos = 0;
+    do {
+        size_t len = std::min<size_t>(raw.size() - pos, 65535);
+        bool last = pos + len == raw.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(static_cast<unsigned char>(len));
+        zlib.push_back(static_cast<unsigned char>(len >> 8));
+        zlib.push_back(static_cast<unsigned char>(~len));
+        zlib.push_back(static_cast<unsigned char>(~len >> 8));
+        zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + len);
+        pos += len;
+    } while (pos < raw.size());
+    PutU32BE(zlib, (b << 16) | a);
+
+    std::vector<unsigned char> header;
+    PutU32BE(header, static_cast<uint32_t>(width));
+    PutU32BE(header, static_cast<uint32_t>(height));
+    header.insert(header.end(), { 8, 2, 0, 0, 0 }); // 8 bits per channel, RGB, no interlace
+
+    const unsigned char signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    std::vector<unsigned char> file(signature, signature + sizeof(signature));
+    PutChunk(file, "IHDR", header);
+    PutChunk(file, "IDAT", zlib);
+    PutChunk(file, "IEND", {});
+    return WriteFile(path, file);
+}
+
+bool WriteEXR(const std::string& path, int width, int height, const std::vector<glm::vec3>& pixels)
+{
+    std::vector<unsigned char> file;
+    PutLE<uint32_t>(file, 20000630u); // magic
+    PutLE<uint32_t>(file, 2u);        // version 2, single-part scanline
+
+    // header attributes: name, type, size, value
+    PutString(file, "channels"); PutString(file, "chlist"); PutLE<int32_t>(file, 3 * 18 + 1);
+    for (const char* name : { "B", "G", "R" }) { // channels are stored in alphabetical order
+        PutString(file, name);
+        PutLE<int32_t>(file, 2);  // FLOAT
+        PutLE<int32_t>(file, 0);  // pLinear and reserved
+        PutLE<int32_t>(file, 1);  // x sampling
+        PutLE<int32_t>(file, 1);  // y sampling
+    }
+    file.push_back(0);
+    PutByteAttribute(file, "compression", 0); // NO_COMPRESSION, the blocks below are raw floats
+    for (const char* window : { "dataWindow", "displayWindow" }) {
+        PutString(file, window); PutString(file, "box2i"); PutLE<int32_t>(file, 16);
+        PutLE<int32_t>(file, 0); PutLE<int32_t>(file, 0); PutLE<int32_t>(file, width - 1); PutLE<int32_t>(file, height - 1);
+    }
+    PutByteAttribute(file, "lineOrder", 0); // INCREASING_Y, block y = 0 is the top row
+    PutString(file, "pixelAspectRatio"); PutString(file, "float"); PutLE<int32_t>(file, 4); PutLE<float>(file, 1.0f);
+    PutString(file, "screenWindowCenter"); PutString(file, "v2f"); PutLE<int32_t>(file, 8);
+    PutLE<float>(file, 0.0f); PutLE<float>(file, 0.0f);
+    PutString(file, "screenWindowWidth"); PutString(file, "float"); PutLE<int32_t>(file, 4); PutLE<float>(file, 1.0f);
+    file.push_back(0);
+
+    // one scanline per block: y, byte count, then each channel's row; EXR stores the top row first
+    const size_t blockBytes = 8 + static_cast<size_t>(width) * 3 * sizeof(float);
+    uint64_t offset = file.size() + static_cast<size_t>(height) * sizeof(uint64_t);
+    for (int y = 0; y < height; ++y, offset += blockBytes)
+        PutLE<uint64_t>(file, offset);
+    for (int y = 0; y < height; ++y) {
+        PutLE<int32_t>(file, y);
+        PutLE<int32_t>(file, width * 3 * static_cast<int32_t>(sizeof(float)));
+        const glm::vec3* row = &pixels[static_cast<size_t>(height - 1 - y) * width];
+        for (int k = 2; k >= 0; --k)
+            for (int x = 0; x < width; ++x)
+                PutLE<float>(file, row[x][k]);
+    }
+    return WriteFile(path, file);
+}
@@ -0,0 +1,152 @@
+#include "LightBVH.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const float kPi = 3.14159265f;
+
+struct Cone {
+    glm::vec3 axis;
+    float thetaO;
+};
+
+float angleBetween(const glm::vec3& a, const glm::vec3& b) {
+    return std::acos(std::min(std::max(glm::dot(a, b), -1.0f), 1.0f));
+}
+
+// smallest cone around both (Conty Estevez and Kulla, "Importance Sampling of Many Lights with Adaptive Tree Splitting")
+Cone mergeCones(Cone a, Cone b) {
+    if (a.thetaO < b.thetaO) std::swap(a, b);
+    float thetaD = angleBetween(a.axis, b.axis);
+    if (std::min(thetaD + b.thetaO, kPi) <= a.thetaO) return a;
+
+    float thetaO = (a.thetaO + thetaD + b.thetaO) * 0.5f;
+    if (thetaO >= kPi) return { a.axis, kPi };
+
+    // rotate a's axis towards b's by the growth of the angle
+    float thetaR = thetaO - a.thetaO;
+    glm::vec3 ortho = b.axis - a.axis * glm::dot(a.axis, b.axis);
+    float len = glm::length(ortho);
+    if (len < 1e-6f) return { a.axis, thetaO };
+    glm::vec3 axis = a.axis * std::cos(thetaR) + (ortho / len) * std::sin(thetaR);
+    return { glm::normalize(axis), thetaO };
+}
+
+} // namespace
+
+LightBVH::LightBVH() = default;
+
+void LightBVH::build(const LightSampler& sampler)
+{
+    nodes.clear();
+    int n = sampler.count();
+    if (n == 0) return;
+    nodes.reserve(2 * n - 1);
+    std::vector<int> order(n);
+    for (int i = 0; i < n; ++i) order[i] = i;
+    buildRecursive(sampler, order, 0, n);
+}
+
+// median split of the centroids on their longest axis; returns the node index
+int LightBVH::buildRecursive(const LightSampler& sampler, std::vector<int>& order, int first, int last)
+{
+    int nodeIndex = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+
+    if (last - first == 1) {
+        const EmissiveTriangle& e = sampler.lights[order[first]];
+        AABB b = AABB::empty();
+        b.expand(e.v0); b.expand(e.v1); b.expand(e.v2);
+        LightBVHNode& leaf = nodes[nodeIndex];
+        leaf.bmin = b.bmin;
+        leaf.bmax = b.bmax;
+        leaf.power = LightSampler::power(e);
+        leaf.axis = glm::normalize(glm::cross(e.v1 - e.v0, e.v2 - e.v0));
+        leaf.thetaO = 0.0f;
+        leaf.offset = -(order[first] + 1);
+        return nodeIndex;
+    }
+
+    AABB centroids = AABB::empty();
+    for (int i = first; i < last; ++i) {
+        const EmissiveTriangle& e = sampler.lights[order[i]];
+        centroids.expand((e.v0 + e.v1 + e.v2) / 3.0f);
+    }
+    int axis = centroids.maxExtentAxis();
+    int mid = (first + last) / 2;
+    std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + last, [&](int a, int b) {
+        const EmissiveTriangle& ea = sampler.lights[a];
+        const EmissiveTriangle& eb = sampler.lights[b];
+        return (ea.v0 + ea.v1 + ea.v2)[axis] < (eb.v0 + eb.v1 + eb.v2)[axis];
+    });
+
+    // the recursion grows the node array, so take results into locals first
+    int left = buildRecursive(sampler, order, first, mid);
+    int right = buildRecursive(sampler, order, mid, last);
+
+    const LightBVHNode& l = nodes[left];
+    const LightBVHNode& r = nodes[right];
+    Cone cone = mergeCones({ l.axis, l.thetaO }, { r.axis, r.thetaO });
+    LightBVHNode node;
+    node.bmin = glm::min(l.bmin, r.bmin);
+    node.bmax = glm::max(l.bmax, r.bmax);
+    node.power = l.power + r.power;
+    node.axis = cone.axis;
+    node.thetaO = cone.thetaO;
+    node.offset = right;
+    nodes[nodeIndex] = node;
+    return nodeIndex;
+}
+
+// The node is bounded by a sphere around its box. thetaU is the angle that sphere covers from p;
+// every emitter normal is then at least theta - thetaO - thetaU away from the direction to p, and
+// every direction into the node at most thetaU away from its centre as seen from p.
+float LightBVH::importance(const LightBVHNode& node, const glm::vec3& p, const glm::vec3& n)
+{
+    glm::vec3 center = (node.bmin + node.bmax) * 0.5f;
+    float r2 = glm::dot(node.bmax - center, node.bmax - center);
+    glm::vec3 toNode = center - p;
+    float d2 = glm::dot(toNode, toNode);
+    // p inside the bounding sphere: no direction can be ruled out
+    if (d2 <= r2) return node.power / std::max(r2, 1e-8f);
+
+    glm::vec3 dir = toNode / std::sqrt(d2);
+    float thetaU = std::asin(std::min(std::sqrt(r2 / d2), 1.0f));
+
+    float thetaE = std::max(0.0f, angleBetween(node.axis, -dir) - node.thetaO - thetaU);
+    if (thetaE >= 0.5f * kPi) return 0.0f;
+    float thetaI = std::max(0.0f, angleBetween(n, dir) - thetaU);
+    if (thetaI >= 0.5f * kPi) return 0.0f;
+
+    return node.power * std::cos(thetaE) * std::cos(thetaI) / d2;
+}
+
+int LightBVH::sample(const glm::vec3& p, const glm::vec3& n, float u, float& pmf) const
+{
+    pmf = 0.0f;
+    if (nodes.empty()) return -1;
+    float prob = 1.0f;
+    int index = 0;
+    while (!nodes[index].isLeaf()) {
+        int left = index + 1;
+        int right = nodes[index].offset;
+        float wl = importance(nodes[left], p, n);
+        float wr = importance(nodes[right], p, n);
+        if (wl + wr <= 0.0f) return -1;
+        // pick a child and stretch u back over [0, 1) for the next level
+        float pl = wl / (wl + wr);
+        if (u < pl) {
+            u = std::min(u / pl, 0.99999994f);
+            prob *= pl;
+            index = left;
+        } else {
+            u = std::min((u - pl) / (1.0f - pl), 0.99999994f);
+            prob *= 1.0f - pl;
+            index = right;
+        }
+    }
+    pmf = prob;
+    return nodes[index].light();
+}
@@ -0,0 +1,86 @@
+#include "LightSampler.h"
+
+#include <algorithm>
+
+LightSampler::LightSampler() = default;
+
+float LightSampler::power(const EmissiveTriangle& e)
+{
+    return glm::dot(e.emission, glm::vec3(0.2126f, 0.7152f, 0.0722f)) * e.area;
+}
+
+void LightSampler::build(const Scene& scene)
+{
+    lights.clear();
+    std::vector<float> weights;
+    std::vector<char> seen;
+    for (const auto& inst : scene.instances) {
+        const BVH& g = scene.geometries[inst.geometry];
+        // SBVH may reference a triangle several times (same bvhTri::id); each is one light
+        bool duplicates = static_cast<int>(g.primitives.size()) != g.inputPrimitiveCount;
+        seen.clear();
+        if (duplicates) {
+            int maxId = -1;
+            for (const auto& t : g.primitives)
+                maxId = std::max(maxId, t.id);
+            seen.assign(static_cast<size_t>(maxId + 1), 0);
+        }
+        for (const auto& t : g.primitives) {
+            const Material& m = scene.materials[t.material];
+            if (!m.isEmissive()) continue;
+            if (duplicates && t.id >= 0) {
+                if (seen[t.id]) continue;
+                seen[t.id] = 1;
+            }
+            EmissiveTriangle e;
+            e.v0 = glm::vec3(inst.objectToWorld * glm::vec4(t.v0, 1.0f));
+            e.v1 = glm::vec3(inst.objectToWorld * glm::vec4(t.v1, 1.0f));
+            e.v2 = glm::vec3(inst.objectToWorld * glm::vec4(t.v2, 1.0f));
+            e.emission = m.emission;
+            e.area = glm::length(glm::cross(e.v1 - e.v0, e.v2 - e.v0)) * 0.5f;
+            float p = power(e);
+            if (!(p > 0.0f)) continue; // degenerate triangles can never be sampled
+            lights.push_back(e);
+            weights.push_back(p);
+        }
+    }
+
+    // Vose's alias method: scale the probabilities to an average of 1, then pair each light below 1
+    // with one above it that donates the remainder of its slot
+    int n = static_cast<int>(lights.size());
+    threshold.assign(n, 1.0f);
+    alias.resize(n);
+    probability.resize(n);
+    double total = 0.0;
+    for (float p : weights) total += p;
+
+    std::vector<double> scaled(n);
+    std::vector<int> small, large;
+    for (int i = 0; i < n; ++i) {
+        alias[i] = i;
+        probability[i] = static_cast<float>(weights[i] / total);
+        scaled[i] = weights[i] / total * n;
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+        int s = small.back(); small.pop_back();
+        int l = large.back();
+        threshold[s] = static_cast<float>(scaled[s]);
+        alias[s] = l;
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // whatever is left is 1 up to rounding and keeps its own slot (threshold stays 1)
+}
+
+int LightSampler::sample(float u) const
+{
+    int n = count();
+    if (n == 0) return -1;
+    float x = u * static_cast<float>(n);
+    int i = std::min(std::max(static_cast<int>(x), 0), n - 1);
+    return x - static_cast<float>(i) < threshold[i] ? i : alias[i];
+}
@@ -1,18 +1,23 @@
 #include "Mesh.h"
 
 // constructor
-Mesh::Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices)
+Mesh::Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, bool uploadToGPU)
+    : VAO(0), VBO(0), EBO(0)
 {
     this->vertices = vertices;
     this->indices = indices;
 
     // now that we have all the required data, set the vertex buffers and its attribute pointers.
-    setupMesh();
+    if (uploadToGPU)
+        setupMesh();
 }
 
 // render the mesh
 void Mesh::Draw(Shader& shader)
 {
+    // CPU-only meshes have nothing to draw
+    if (!VAO) return;
+
     // draw mesh
     glBindVertexArray(VAO);
     glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
@@ -1,7 +1,8 @@
 #include "Model.h"
 
 // constructor, expects a filepath to a 3D model.
-Model::Model(string const& path)
+Model::Model(string const& path, bool uploadToGPU)
+    : m_UploadToGPU(uploadToGPU)
 {
     loadModel(path);
 }
@@ -107,5 +108,5 @@ Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene)
     }
 
     // return a mesh object created from the extracted mesh data
-    return Mesh(vertices, indices);
+    return Mesh(vertices, indices, m_UploadToGPU);
 }
\ No newline at end of file
@@ -0,0 +1,270 @@
+#include "RayPacket.h"
+
+#include <immintrin.h>
+
+#include "TraversalStack.h"
+
+RayPacket8::RayPacket8()
+{
+    for (int i = 0; i < 8; ++i) {
+        ox[i] = oy[i] = oz[i] = 0.0f;
+        dx[i] = dy[i] = 0.0f;
+        dz[i] = -1.0f;
+        tmin[i] = 1e-4f;
+        tmax[i] = 1e30f;
+    }
+}
+
+void RayPacket8::set(int lane, const Ray& r)
+{
+    ox[lane] = r.o.x; oy[lane] = r.o.y; oz[lane] = r.o.z;
+    dx[lane] = r.d.x; dy[lane] = r.d.y; dz[lane] = r.d.z;
+    tmin[lane] = r.tmin;
+    tmax[lane] = r.tmax;
+}
+
+#ifdef __AVX__
+
+namespace {
+
+// packet in registers, with the reciprocal directions the slab test needs
+struct PacketRegs {
+    __m256 ox, oy, oz;
+    __m256 dx, dy, dz;
+    __m256 ix, iy, iz;
+    __m256 tmin;
+    float dirSum[3]; // summed direction of the active lanes, orders the children of interior nodes
+};
+
+void setDirections(PacketRegs& r, int active) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    r.ix = _mm256_div_ps(one, r.dx);
+    r.iy = _mm256_div_ps(one, r.dy);
+    r.iz = _mm256_div_ps(one, r.dz);
+
+    alignas(32) float d[3][8];
+    _mm256_store_ps(d[0], r.dx);
+    _mm256_store_ps(d[1], r.dy);
+    _mm256_store_ps(d[2], r.dz);
+    for (int a = 0; a < 3; ++a) {
+        r.dirSum[a] = 0.0f;
+        for (int i = 0; i < 8; ++i)
+            if (active & (1 << i)) r.dirSum[a] += d[a][i];
+    }
+}
+
+__m256 laneMask(int bits) {
+    return _mm256_castsi256_ps(_mm256_setr_epi32(
+        (bits & 1) ? -1 : 0, (bits & 2) ? -1 : 0, (bits & 4) ? -1 : 0, (bits & 8) ? -1 : 0,
+        (bits & 16) ? -1 : 0, (bits & 32) ? -1 : 0, (bits & 64) ? -1 : 0, (bits & 128) ? -1 : 0));
+}
+
+// AABB::intersectAABB for every lane; returns the lanes of `active` that overlap the box
+int slabPacket(const AABB& b, const PacketRegs& r, __m256 tmax, int active) {
+    __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(b.bmin.x), r.ox), r.ix);
+    __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(b.bmin.y), r.oy), r.iy);
+    __m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(b.bmin.z), r.oz), r.iz);
+    __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(b.bmax.x), r.ox), r.ix);
+    __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(b.bmax.y), r.oy), r.iy);
+    __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(b.bmax.z), r.oz), r.iz);
+
+    __m256 tNear = _mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_max_ps(_mm256_min_ps(t0y, t1y), _mm256_min_ps(t0z, t1z)));
+    __m256 tFar = _mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_min_ps(_mm256_max_ps(t0y, t1y), _mm256_max_ps(t0z, t1z)));
+    tNear = _mm256_max_ps(r.tmin, tNear);
+    tFar = _mm256_min_ps(tmax, tFar);
+
+    __m256 hit = _mm256_and_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ), _mm256_cmp_ps(tFar, _mm256_setzero_ps(), _CMP_GT_OQ));
+    return _mm256_movemask_ps(hit) & active;
+}
+
+// bvhTri::intersectTriangle for every lane of `active`; returns the lanes with a hit in (tmin, tmax)
+int trianglePacket(const bvhTri& tri, const PacketRegs& r, __m256 tmax, int active, __m256& outT, __m256& outU, __m256& outV) {
+    const glm::vec3 e1 = tri.v1 - tri.v0;
+    const glm::vec3 e2 = tri.v2 - tri.v0;
+    const __m256 e1x = _mm256_set1_ps(e1.x), e1y = _mm256_set1_ps(e1.y), e1z = _mm256_set1_ps(e1.z);
+    const __m256 e2x = _mm256_set1_ps(e2.x), e2y = _mm256_set1_ps(e2.y), e2z = _mm256_set1_ps(e2.z);
+
+    // p = cross(d, e2), det = dot(e1, p)
+    __m256 px = _mm256_sub_ps(_mm256_mul_ps(r.dy, e2z), _mm256_mul_ps(e2y, r.dz));
+    __m256 py = _mm256_sub_ps(_mm256_mul_ps(r.dz, e2x), _mm256_mul_ps(e2z, r.dx));
+    __m256 pz = _mm256_sub_ps(_mm256_mul_ps(r.dx, e2y), _mm256_mul_ps(e2x, r.dy));
+    __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    __m256 absDet = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det);
+    __m256 mask = _mm256_cmp_ps(absDet, _mm256_set1_ps(1e-8f), _CMP_GE_OQ);
+    __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+    // u = dot(o - v0, p) / det
+    __m256 tx = _mm256_sub_ps(r.ox, _mm256_set1_ps(tri.v0.x));
+    __m256 ty = _mm256_sub_ps(r.oy, _mm256_set1_ps(tri.v0.y));
+    __m256 tz = _mm256_sub_ps(r.oz, _mm256_set1_ps(tri.v0.z));
+    __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), invDet);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, _mm256_setzero_ps(), _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+
+    // q = cross(o - v0, e1), v = dot(d, q) / det
+    __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(e1y, tz));
+    __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(e1z, tx));
+    __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(e1x, ty));
+    __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r.dx, qx), _mm256_mul_ps(r.dy, qy)), _mm256_mul_ps(r.dz, qz)), invDet);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+
+    // t = dot(e2, q) / det
+    __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, r.tmin, _CMP_GT_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, tmax, _CMP_LT_OQ));
+
+    outT = t; outU = u; outV = v;
+    return _mm256_movemask_ps(mask) & active;
+}
+
+// pushes both children of an interior node, the one nearer along the packet's mean direction last
+// so it is popped first
+void pushChildren(const BVH& bvh, int nodeIdx, const PacketRegs& r, TraversalStack<int, 64>& stack, int& sp) {
+    int left = nodeIdx + 1;
+    int right = bvh.nodes[nodeIdx].offset;
+    glm::vec3 toRight = bvh.nodes[right].bounds.centroid() - bvh.nodes[left].bounds.centroid();
+    glm::vec3 extent = glm::abs(toRight);
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    if (toRight[axis] * r.dirSum[axis] < 0.0f) {
+        stack[sp++] = left;
+        stack[sp++] = right;
+    } else {
+        stack[sp++] = right;
+        stack[sp++] = left;
+    }
+}
+
+// Closest hits of the active lanes in one bottom-level BVH. tmax is shared with the caller and
+// shrinks with every hit; returns the lanes that found one.
+int intersectBVHPacket(const BVH& bvh, const PacketRegs& r, __m256& tmax, int active, int prim[8], float u[8], float v[8]) {
+    if (bvh.nodes.empty()) return 0;
+    int found = 0;
+    TraversalStack<int, 64> stack(bvh.traversalStackSize());
+    int sp = 0;
+    stack[sp++] = 0;
+    alignas(32) float hu[8], hv[8];
+
+    while (sp > 0) {
+        int nodeIdx = stack[--sp];
+        const BVHNode& node = bvh.nodes[nodeIdx];
+        int mask = slabPacket(node.bounds, r, tmax, active);
+        if (!mask) continue;
+        if (!node.isLeaf()) {
+            pushChildren(bvh, nodeIdx, r, stack, sp);
+            continue;
+        }
+        for (int i = 0; i < node.count; ++i) {
+            int idx = node.offset + i;
+            __m256 t, tu, tv;
+            int hit = trianglePacket(bvh.primitives[idx], r, tmax, mask, t, tu, tv);
+            if (!hit) continue;
+            tmax = _mm256_blendv_ps(tmax, t, laneMask(hit));
+            _mm256_store_ps(hu, tu);
+            _mm256_store_ps(hv, tv);
+            for (int lane = 0; lane < 8; ++lane) {
+                if (!(hit & (1 << lane))) continue;
+                prim[lane] = idx;
+                u[lane] = hu[lane];
+                v[lane] = hv[lane];
+            }
+            found |= hit;
+        }
+    }
+    return found;
+}
+
+// packet moved into an instance's object space; directions stay unnormalized so distances match
+PacketRegs toObjectSpace(const PacketRegs& w, const glm::mat4& m, int active) {
+    PacketRegs o;
+    o.tmin = w.tmin;
+    o.ox = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[0][0]), w.ox), _mm256_mul_ps(_mm256_set1_ps(m[1][0]), w.oy)),
+                         _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[2][0]), w.oz), _mm256_set1_ps(m[3][0])));
+    o.oy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[0][1]), w.ox), _mm256_mul_ps(_mm256_set1_ps(m[1][1]), w.oy)),
+                         _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[2][1]), w.oz), _mm256_set1_ps(m[3][1])));
+    o.oz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[0][2]), w.ox), _mm256_mul_ps(_mm256_set1_ps(m[1][2]), w.oy)),
+                         _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[2][2]), w.oz), _mm256_set1_ps(m[3][2])));
+    o.dx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[0][0]), w.dx), _mm256_mul_ps(_mm256_set1_ps(m[1][0]), w.dy)),
+                         _mm256_mul_ps(_mm256_set1_ps(m[2][0]), w.dz));
+    o.dy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[0][1]), w.dx), _mm256_mul_ps(_mm256_set1_ps(m[1][1]), w.dy)),
+                         _mm256_mul_ps(_mm256_set1_ps(m[2][1]), w.dz));
+    o.dz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[0][2]), w.dx), _mm256_mul_ps(_mm256_set1_ps(m[1][2]), w.dy)),
+                         _mm256_mul_ps(_mm256_set1_ps(m[2][2]), w.dz));
+    setDirections(o, active);
+    return o;
+}
+
+} // namespace
+
+int IntersectPacket(const Scene& scene, RayPacket8& packet, int active, SceneHit hits[8])
+{
+    active &= 0xff;
+    if (scene.tlas.nodes.empty() || !active) return 0;
+
+    PacketRegs r;
+    r.ox = _mm256_loadu_ps(packet.ox); r.oy = _mm256_loadu_ps(packet.oy); r.oz = _mm256_loadu_ps(packet.oz);
+    r.dx = _mm256_loadu_ps(packet.dx); r.dy = _mm256_loadu_ps(packet.dy); r.dz = _mm256_loadu_ps(packet.dz);
+    r.tmin = _mm256_loadu_ps(packet.tmin);
+    setDirections(r, active);
+    __m256 tmax = _mm256_loadu_ps(packet.tmax);
+
+    int found = 0;
+    TraversalStack<int, 64> stack(scene.tlas.traversalStackSize());
+    int sp = 0;
+    stack[sp++] = 0;
+    int prim[8];
+    float u[8], v[8];
+
+    while (sp > 0) {
+        int nodeIdx = stack[--sp];
+        const BVHNode& node = scene.tlas.nodes[nodeIdx];
+        int mask = slabPacket(node.bounds, r, tmax, active);
+        if (!mask) continue;
+        if (!node.isLeaf()) {
+            pushChildren(scene.tlas, nodeIdx, r, stack, sp);
+            continue;
+        }
+        for (int i = 0; i < node.count; ++i) {
+            int instIdx = scene.tlas.primitives[node.offset + i].id;
+            const Instance& inst = scene.instances[instIdx];
+            PacketRegs objRegs = toObjectSpace(r, inst.worldToObject, mask);
+            int hit = intersectBVHPacket(scene.geometries[inst.geometry], objRegs, tmax, mask, prim, u, v);
+            for (int lane = 0; lane < 8; ++lane) {
+                if (!(hit & (1 << lane))) continue;
+                hits[lane].instance = instIdx;
+                hits[lane].prim = prim[lane];
+                hits[lane].u = u[lane];
+                hits[lane].v = v[lane];
+            }
+            found |= hit;
+        }
+    }
+
+    alignas(32) float t[8];
+    _mm256_store_ps(t, tmax);
+    for (int lane = 0; lane < 8; ++lane) {
+        if (!(found & (1 << lane))) continue;
+        hits[lane].t = t[lane];
+        packet.tmax[lane] = t[lane];
+    }
+    return found;
+}
+
+#else
+
+int IntersectPacket(const Scene& scene, RayPacket8& packet, int active, SceneHit hits[8])
+{
+    int found = 0;
+    for (int lane = 0; lane < 8; ++lane) {
+        if (!(active & (1 << lane))) continue;
+        Ray r(glm::vec3(packet.ox[lane], packet.oy[lane], packet.oz[lane]),
+              glm::vec3(packet.dx[lane], packet.dy[lane], packet.dz[lane]), packet.tmin[lane], packet.tmax[lane]);
+        if (scene.intersectNearest(r, hits[lane])) {
+            packet.tmax[lane] = hits[lane].t;
+            found |= 1 << lane;
+        }
+    }
+    return found;
+}
+
+#endif
@@ -0,0 +1,208 @@
+#include "Scene.h"
+
+#include "TraversalStack.h"
+
+Scene::Scene() = default;
+
+int Scene::addGeometry(std::vector<bvhTri> tris, const BVHBuildSettings& settings)
+{
+    geometries.emplace_back();
+    geometries.back().build(std::move(tris), settings);
+    wideGeometries.emplace_back();
+    wideGeometries.back().build(geometries.back());
+    return static_cast<int>(geometries.size()) - 1;
+}
+
+int Scene::addGeometry(BVH blas)
+{
+    geometries.push_back(std::move(blas));
+    wideGeometries.emplace_back();
+    wideGeometries.back().build(geometries.back());
+    return static_cast<int>(geometries.size()) - 1;
+}
+
+int Scene::addInstance(int geometry, const glm::mat4& objectToWorld)
+{
+    Instance inst;
+    inst.geometry = geometry;
+    instances.push_back(inst);
+    int index = static_cast<int>(instances.size()) - 1;
+    setTransform(index, objectToWorld);
+    return index;
+}
+
+int Scene::addMaterial(const glm::vec3& albedo, const glm::vec3& emission)
+{
+    for (size_t i = 0; i < materials.size(); ++i)
+        if (materials[i].albedo == albedo && materials[i].emission == emission)
+            return static_cast<int>(i);
+    materials.push_back({ albedo, emission });
+    return static_cast<int>(materials.size()) - 1;
+}
+
+void Scene::setTransform(int instance, const glm::mat4& objectToWorld)
+{
+    Instance& inst = instances[instance];
+    inst.objectToWorld = objectToWorld;
+    inst.worldToObject = glm::inverse(objectToWorld);
+    updateWorldBounds(inst);
+}
+
+// world bounds of the transformed object-space root box
+void Scene::updateWorldBounds(Instance& inst) const
+{
+    inst.worldBounds = AABB();
+    const BVH& blas = geometries[inst.geometry];
+    if (blas.nodes.empty()) return;
+    const AABB& b = blas.nodes[0].bounds;
+    for (int corner = 0; corner < 8; ++corner) {
+        glm::vec3 p((corner & 1) ? b.bmax.x : b.bmin.x,
+                    (corner & 2) ? b.bmax.y : b.bmin.y,
+                    (corner & 4) ? b.bmax.z : b.bmin.z);
+        inst.worldBounds.expand(glm::vec3(inst.objectToWorld * glm::vec4(p, 1.0f)));
+    }
+}
+
+void Scene::buildTopLevel()
+{
+    std::vector<bvhTri> proxies;
+    proxies.reserve(instances.size());
+    for (size_t i = 0; i < instances.size(); ++i) {
+        const AABB& b = instances[i].worldBounds;
+        // a degenerate triangle through the two corners has exactly the instance bounds
+        proxies.emplace_back(b.bmin, b.bmax, b.bmin, static_cast<int>(i));
+    }
+
+    BVHBuildSettings settings;
+    settings.maxLeafSize = 1;
+    settings.buildThreads = 1;
+    tlas.build(std::move(proxies), settings);
+}
+
+bool Scene::refitGeometry(int geometry)
+{
+    BVH& blas = geometries[geometry];
+    blas.refit();
+    bool rebuilt = blas.needsRebuild();
+    if (rebuilt)
+        blas.rebuild();
+    wideGeometries[geometry].build(blas);
+    for (auto& inst : instances) {
+        if (inst.geometry == geometry)
+            updateWorldBounds(inst);
+    }
+    return rebuilt;
+}
+
+int Scene::triangleCount() const
+{
+    int count = 0;
+    for (const auto& g : geometries)
+        count += g.inputPrimitiveCount;
+    return count;
+}
+
+int Scene::referenceCount() const
+{
+    int count = 0;
+    for (const auto& g : geometries)
+        count += static_cast<int>(g.primitives.size());
+    return count;
+}
+
+int Scene::maxDepth() const
+{
+    int depth = tlas.maxDepth;
+    for (const auto& g : geometries)
+        depth = std::max(depth, g.maxDepth);
+    return depth;
+}
+
+AABB Scene::bounds() const
+{
+    return tlas.nodes.empty() ? AABB() : tlas.nodes[0].bounds;
+}
+
+// Top level front to back like BVH::intersectNearest: instances nearer along the ray are traced first
+bool Scene::intersectNearest(const Ray& r, SceneHit& hit) const
+{
+    if (tlas.nodes.empty()) return false;
+    float tnear, tfar;
+    if (!tlas.nodes[0].bounds.intersectAABB(r, tnear, tfar)) return false;
+
+    struct Entry {
+        int node;
+        float t;
+    };
+    TraversalStack<Entry, 64> stack(tlas.traversalStackSize());
+    int sp = 0;
+    stack[sp++] = { 0, tnear };
+    Ray ray = r;
+    bool found = false;
+
+    while (sp > 0) {
+        Entry e = stack[--sp];
+        if (e.t > ray.tmax) continue;
+        const BVHNode& node = tlas.nodes[e.node];
+        if (!node.isLeaf()) {
+            Entry a = { e.node + 1, 0.0f }, b = { node.offset, 0.0f };
+            bool hitA = tlas.nodes[a.node].bounds.intersectAABB(ray, a.t, tfar);
+            bool hitB = tlas.nodes[b.node].bounds.intersectAABB(ray, b.t, tfar);
+            if (hitA && hitB) {
+                if (a.t < b.t) std::swap(a, b);
+                stack[sp++] = a;
+                stack[sp++] = b;
+            } else if (hitA) {
+                stack[sp++] = a;
+            } else if (hitB) {
+                stack[sp++] = b;
+            }
+            continue;
+        }
+        for (int i = 0; i < node.count; ++i) {
+            int instIdx = tlas.primitives[node.offset + i].id;
+            const Instance& inst = instances[instIdx];
+            // the object-space direction is left unnormalized so hit distances stay in world units
+            Ray objRay(glm::vec3(inst.worldToObject * glm::vec4(ray.o, 1.0f)),
+                       glm::vec3(inst.worldToObject * glm::vec4(ray.d, 0.0f)), ray.tmin, ray.tmax);
+            float t, u, v;
+            int prim;
+            if (wideGeometries[inst.geometry].intersectNearest(objRay, t, prim, u, v)) {
+                ray.tmax = t;
+                hit.t = t; hit.u = u; hit.v = v;
+                hit.instance = instIdx;
+                hit.prim = prim;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+bool Scene::occluded(const Ray& r) const
+{
+    if (tlas.nodes.empty()) return false;
+    TraversalStack<int, 64> stack(tlas.traversalStackSize());
+    int sp = 0;
+    stack[sp++] = 0;
+
+    while (sp > 0) {
+        int nodeIdx = stack[--sp];
+        const BVHNode& node = tlas.nodes[nodeIdx];
+        float tnear, tfar;
+        if (!node.bounds.intersectAABB(r, tnear, tfar)) continue;
+        if (!node.isLeaf()) {
+            stack[sp++] = nodeIdx + 1;
+            stack[sp++] = node.offset;
+            continue;
+        }
+        for (int i = 0; i < node.count; ++i) {
+            const Instance& inst = instances[tlas.primitives[node.offset + i].id];
+            Ray objRay(glm::vec3(inst.worldToObject * glm::vec4(r.o, 1.0f)),
+                       glm::vec3(inst.worldToObject * glm::vec4(r.d, 0.0f)), r.tmin, r.tmax);
+            if (wideGeometries[inst.geometry].occluded(objRay))
+                return true;
+        }
+    }
+    return false;
+}
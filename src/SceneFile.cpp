@@ -0,0 +1,96 @@
+#include "SceneFile.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace {
+
+bool IsAbsolute(const std::string& path) {
+    return (!path.empty() && (path[0] == '/' || path[0] == '\\')) || (path.size() > 1 && path[1] == ':');
+}
+
+std::string DirectoryOf(const std::string& path) {
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+bool ReadVec3(std::istringstream& in, glm::vec3& v) {
+    return static_cast<bool>(in >> v.x >> v.y >> v.z);
+}
+
+} // namespace
+
+bool LoadSceneFile(const std::string& path, SceneFile& out)
+{
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Could not open scene file " << path << std::endl;
+        return false;
+    }
+
+    out = SceneFile();
+    const std::string directory = DirectoryOf(path);
+    glm::mat4 transform(1.0f);
+    std::string line;
+    for (int lineNumber = 1; std::getline(file, line); ++lineNumber) {
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+        std::istringstream in(line);
+        std::string keyword;
+        if (!(in >> keyword)) continue;
+
+        bool ok = true;
+        if (keyword == "camera") {
+            ok = ReadVec3(in, out.cameraPosition);
+            float yaw, pitch, fov;
+            if (ok && in >> yaw) {
+                ok = static_cast<bool>(in >> pitch);
+                out.cameraYaw = yaw;
+                out.cameraPitch = pitch;
+                if (in >> fov) out.cameraFov = fov;
+            }
+            out.hasCamera = true;
+        } else if (keyword == "translate") {
+            glm::vec3 t;
+            ok = ReadVec3(in, t);
+            transform = glm::translate(transform, t);
+        } else if (keyword == "rotate") {
+            float degrees;
+            glm::vec3 axis;
+            ok = in >> degrees && ReadVec3(in, axis);
+            transform = glm::rotate(transform, glm::radians(degrees), axis);
+        } else if (keyword == "scale") {
+            glm::vec3 s;
+            ok = static_cast<bool>(in >> s.x);
+            if (ok && !(in >> s.y >> s.z)) s = glm::vec3(s.x);
+            transform = glm::scale(transform, s);
+        } else if (keyword == "identity") {
+            transform = glm::mat4(1.0f);
+        } else if (keyword == "model") {
+            SceneModelDesc desc{ std::string(), glm::vec3(0.8f), glm::vec3(0.0f), transform };
+            ok = static_cast<bool>(in >> desc.path);
+            if (ok && !IsAbsolute(desc.path)) desc.path = directory + desc.path;
+            std::string attribute;
+            while (ok && in >> attribute) {
+                if (attribute == "albedo") ok = ReadVec3(in, desc.albedo);
+                else if (attribute == "emission") ok = ReadVec3(in, desc.emission);
+                else ok = false;
+            }
+            out.models.push_back(desc);
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            std::cerr << path << ":" << lineNumber << ": cannot parse '" << line << "'" << std::endl;
+            return false;
+        }
+    }
+    if (out.models.empty()) {
+        std::cerr << path << ": no models" << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -4,10 +4,10 @@
 #include <fstream>
 #include <sstream>
 
-Shader::Shader(const std::string& m_VertexFilePath, const std::string& m_FragmentFilePath) : m_VertexFilePath(m_VertexFilePath), m_FragmentFilePath(m_FragmentFilePath), m_RendererID(0)
+Shader::Shader(const std::string& m_VertexFilePath, const std::string& m_FragmentFilePath, const std::string& defines) : m_VertexFilePath(m_VertexFilePath), m_FragmentFilePath(m_FragmentFilePath), m_RendererID(0)
 {
-    std::string vertexShaderSource = ReadShaderSourceFromFile(m_VertexFilePath);
-    std::string fragmentShaderSource = ReadShaderSourceFromFile(m_FragmentFilePath);
+    std::string vertexShaderSource = InsertDefines(ReadShaderSourceFromFile(m_VertexFilePath), defines);
+    std::string fragmentShaderSource = InsertDefines(ReadShaderSourceFromFile(m_FragmentFilePath), defines);
     if (vertexShaderSource.empty() || fragmentShaderSource.empty()) {
         std::cerr << "Failed to read shader source from files." << std::endl;
         return;
@@ -18,6 +18,23 @@ Shader::Shader(const std::string& m_VertexFilePath, const std::string& m_Fragmen
     }
 }
 
+Shader::Shader(GLenum shaderType, const std::string& filePath, const std::string& defines) : m_RendererID(0), m_ComputeFilePath(filePath)
+{
+    if (shaderType != GL_COMPUTE_SHADER) {
+        std::cerr << "Only compute shaders make a single-stage program." << std::endl;
+        return;
+    }
+    std::string computeShaderSource = InsertDefines(ReadShaderSourceFromFile(m_ComputeFilePath), defines);
+    if (computeShaderSource.empty()) {
+        std::cerr << "Failed to read shader source from files." << std::endl;
+        return;
+    }
+    m_RendererID = CreateComputeShader(computeShaderSource);
+    if (m_RendererID == 0) {
+        std::cerr << "Failed to create compute program " << m_ComputeFilePath << "." << std::endl;
+    }
+}
+
 Shader::~Shader()
 {
     if (m_RendererID != 0)
@@ -83,6 +100,18 @@ void Shader::BindUniformBlock(const std::string& blockName, GLuint bindingPoint)
     glUniformBlockBinding(m_RendererID, index, bindingPoint);
 }
 
+// #version must stay the first directive, so the defines go on the line after it
+std::string Shader::InsertDefines(const std::string& source, const std::string& defines)
+{
+    if (source.empty() || defines.empty())
+        return source;
+    size_t version = source.find("#version");
+    size_t lineEnd = version == std::string::npos ? std::string::npos : source.find('\n', version);
+    if (lineEnd == std::string::npos)
+        return defines + source;
+    return source.substr(0, lineEnd + 1) + defines + source.substr(lineEnd + 1);
+}
+
 int Shader::GetUniformLocation(const std::string& name)
 {
     if (m_RendererID == 0) return -1;
@@ -107,8 +136,25 @@ std::string Shader::ReadShaderSourceFromFile(const std::string& filePath)
         std::cerr << "Not opening this shader file: " << filePath << std::endl;
         return "";
     }
+    const size_t slash = filePath.find_last_of("/\\");
+    const std::string directory = slash == std::string::npos ? std::string() : filePath.substr(0, slash + 1);
+
     std::stringstream buffer;
-    buffer << file.rdbuf();
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t start = line.find_first_not_of(" \t");
+        if (start != std::string::npos && line.compare(start, 8, "#include") == 0) {
+            size_t open = line.find('"', start);
+            size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+            if (close != std::string::npos) {
+                std::string included = ReadShaderSourceFromFile(directory + line.substr(open + 1, close - open - 1));
+                if (included.empty()) return "";
+                buffer << included << '\n';
+                continue;
+            }
+        }
+        buffer << line << '\n';
+    }
     return buffer.str();
 }
 
@@ -153,4 +199,28 @@ unsigned int Shader::CreateShader(const std::string& vertexShaderSource, const s
     glDeleteShader(vertexShader);
     glDeleteShader(fragmentShader);
     return shaderProgram;
+}
+
+unsigned int Shader::CreateComputeShader(const std::string& computeShaderSource)
+{
+    unsigned int computeShader = CompileShader(GL_COMPUTE_SHADER, computeShaderSource);
+    if (computeShader == static_cast<unsigned int>(-1))
+        return 0;
+
+    unsigned int shaderProgram = glCreateProgram();
+    glAttachShader(shaderProgram, computeShader);
+    glLinkProgram(shaderProgram);
+    glDeleteShader(computeShader);
+
+    int success;
+    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        char infoLog[512];
+        glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
+        std::cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        glDeleteProgram(shaderProgram);
+        return 0;
+    }
+    return shaderProgram;
 }
\ No newline at end of file
@@ -0,0 +1,151 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+// pool and worker index of the calling thread
+static thread_local const ThreadPool* t_Pool = nullptr;
+static thread_local int t_WorkerIndex = -1;
+
+ThreadPool::ThreadPool(int numThreads)
+    : m_Pending(0), m_NextQueue(0), m_Stop(false)
+{
+    if (numThreads <= 0)
+        numThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+    for (int i = 0; i < numThreads; ++i)
+        m_Queues.emplace_back(new WorkQueue());
+    for (int i = 0; i < numThreads; ++i)
+        m_Threads.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_WakeMutex);
+        m_Stop = true;
+    }
+    m_Wake.notify_all();
+    for (auto& t : m_Threads)
+        t.join();
+}
+
+int ThreadPool::size() const
+{
+    return static_cast<int>(m_Threads.size());
+}
+
+int ThreadPool::currentWorker() const
+{
+    return t_Pool == this ? t_WorkerIndex : -1;
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    int index = currentWorker();
+    if (index < 0)
+        index = static_cast<int>(m_NextQueue++ % m_Queues.size());
+
+    {
+        std::lock_guard<std::mutex> lock(m_Queues[index]->mutex);
+        m_Queues[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_WakeMutex);
+        m_Pending++;
+    }
+    m_Wake.notify_one();
+}
+
+// own queue from the back, then steal from the front of the others
+bool ThreadPool::popTask(int index, std::function<void()>& task)
+{
+    int n = static_cast<int>(m_Queues.size());
+    if (index >= 0) {
+        WorkQueue& q = *m_Queues[index];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            m_Pending--;
+            return true;
+        }
+    }
+    int first = index >= 0 ? index + 1 : 0;
+    for (int k = 0; k < n; ++k) {
+        WorkQueue& q = *m_Queues[(first + k) % n];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            m_Pending--;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::runPendingTask()
+{
+    std::function<void()> task;
+    if (!popTask(currentWorker(), task))
+        return false;
+    task();
+    return true;
+}
+
+void ThreadPool::workerLoop(int index)
+{
+    t_Pool = this;
+    t_WorkerIndex = index;
+
+    for (;;) {
+        std::function<void()> task;
+        if (popTask(index, task)) {
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_WakeMutex);
+        m_Wake.wait(lock, [this] { return m_Stop || m_Pending > 0; });
+        if (m_Stop && m_Pending == 0)
+            return;
+    }
+}
+
+void ThreadPool::parallelFor(int begin, int end, int grainSize, const std::function<void(int)>& fn)
+{
+    grainSize = std::max(1, grainSize);
+    TaskGroup group(*this);
+    for (int chunk = begin; chunk < end; chunk += grainSize) {
+        int chunkEnd = std::min(end, chunk + grainSize);
+        group.run([chunk, chunkEnd, &fn] {
+            for (int i = chunk; i < chunkEnd; ++i)
+                fn(i);
+        });
+    }
+    group.wait();
+}
+
+TaskGroup::TaskGroup(ThreadPool& pool)
+    : m_Pool(pool), m_Outstanding(0) {}
+
+TaskGroup::~TaskGroup()
+{
+    wait();
+}
+
+void TaskGroup::run(std::function<void()> task)
+{
+    m_Outstanding++;
+    m_Pool.submit([this, task] {
+        task();
+        m_Outstanding--;
+    });
+}
+
+void TaskGroup::wait()
+{
+    while (m_Outstanding > 0) {
+        if (!m_Pool.runPendingTask())
+            std::this_thread::yield();
+    }
+}
@@ -0,0 +1,113 @@
+#include "TileScheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <utility>
+
+// Position of the d-th cell of the Hilbert curve filling an n x n grid (n a power of two)
+static void HilbertToXY(int n, int d, int& x, int& y)
+{
+    x = y = 0;
+    for (int s = 1; s < n; s *= 2) {
+        int rx = 1 & (d / 2);
+        int ry = 1 & (d ^ rx);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+}
+
+TileScheduler::TileScheduler(int width, int height, int tileSize)
+{
+    tileSize = std::max(1, tileSize);
+    int tilesX = (width + tileSize - 1) / tileSize;
+    int tilesY = (height + tileSize - 1) / tileSize;
+
+    // walk the curve over the enclosing power-of-two grid and keep the cells inside the image
+    int n = 1;
+    while (n < tilesX || n < tilesY) n *= 2;
+    m_Tiles.reserve(static_cast<size_t>(tilesX) * tilesY);
+    for (int d = 0; d < n * n; ++d) {
+        int tx, ty;
+        HilbertToXY(n, d, tx, ty);
+        if (tx >= tilesX || ty >= tilesY) continue;
+        Tile t;
+        t.x0 = tx * tileSize;
+        t.y0 = ty * tileSize;
+        t.x1 = std::min(t.x0 + tileSize, width);
+        t.y1 = std::min(t.y0 + tileSize, height);
+        m_Tiles.push_back(t);
+    }
+}
+
+// own deque from the front, then steal from the back of the others
+bool TileScheduler::popTile(int worker, int& tile, bool& stolen)
+{
+    int n = static_cast<int>(m_Queues.size());
+    for (int k = 0; k < n; ++k) {
+        TileQueue& q = *m_Queues[(worker + k) % n];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tiles.empty()) continue;
+        if (k == 0) {
+            tile = q.tiles.front();
+            q.tiles.pop_front();
+        } else {
+            tile = q.tiles.back();
+            q.tiles.pop_back();
+        }
+        stolen = k != 0;
+        return true;
+    }
+    return false;
+}
+
+void TileScheduler::run(ThreadPool& pool, const std::function<void(const Tile&)>& fn)
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    int workers = pool.size();
+    int tileCount = static_cast<int>(m_Tiles.size());
+
+    // worker k starts with tiles [k * tileCount / workers, (k + 1) * tileCount / workers) of the curve
+    m_Queues.clear();
+    for (int k = 0; k < workers; ++k) {
+        m_Queues.emplace_back(new TileQueue());
+        int first = static_cast<int>(static_cast<long long>(k) * tileCount / workers);
+        int last = static_cast<int>(static_cast<long long>(k + 1) * tileCount / workers);
+        for (int i = first; i < last; ++i)
+            m_Queues[k]->tiles.push_back(i);
+    }
+    m_Stats.assign(workers, TileWorkerStats());
+
+    // one task per deque; whichever thread runs it (the caller may, while waiting) works as that worker
+    std::atomic<int> nextWorker(0);
+    Clock::time_point start = Clock::now();
+    TaskGroup group(pool);
+    for (int k = 0; k < workers; ++k) {
+        group.run([this, &nextWorker, &fn] {
+            int worker = nextWorker++;
+            TileWorkerStats& s = m_Stats[worker];
+            int tile;
+            bool stolen;
+            while (popTile(worker, tile, stolen)) {
+                Clock::time_point t0 = Clock::now();
+                fn(m_Tiles[tile]);
+                s.busyMs += std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+                s.tiles++;
+                if (stolen) s.stolen++;
+            }
+        });
+    }
+    group.wait();
+
+    double wallMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    for (auto& s : m_Stats)
+        s.idleMs = std::max(0.0, wallMs - s.busyMs);
+}
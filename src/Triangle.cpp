@@ -1,11 +1,14 @@
 ﻿#include "Triangle.h"
 
+#include <cstring>
+
 Triangle::Triangle()
-    : v0(0.0f), v1(0.0f), v2(0.0f), albedo(0.0f), emission(0.0f) {}
+    : v0(0.0f), e1(0.0f), e2(0.0f) {}
 
-Triangle::Triangle(const glm::vec4& _v0, const glm::vec4& _v1, const glm::vec4& _v2,
-                   const glm::vec4& _albedo, const glm::vec4& _emission)
-    : v0(_v0), v1(_v1), v2(_v2), albedo(_albedo), emission(_emission) {}
+Triangle::Triangle(const glm::vec3& _v0, const glm::vec3& _v1, const glm::vec3& _v2, int material)
+    : v0(_v0, 0.0f), e1(_v1 - _v0, 0.0f), e2(_v2 - _v0, 0.0f) {
+    std::memcpy(&v0.w, &material, sizeof(material));
+}
 
 bvhTri::bvhTri()
 	: v0(0.0f)
@@ -14,31 +17,29 @@ bvhTri::bvhTri()
     , id(0)
     , bounds()
     , centroid(0.0f)
-    , albedo(glm::vec3(0.8f))
-    , emission(0.0f) {
-    bounds.expand(v0);
-    bounds.expand(v1);
-    bounds.expand(v2);
-    centroid = bounds.centroid();
+    , material(0) {
+    updateBounds();
 }
 
-bvhTri::bvhTri(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, int _id,
-               const glm::vec3& alb, const glm::vec3& emi)
+bvhTri::bvhTri(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, int _id, int _material)
     : v0(a)
     , v1(b)
     , v2(c)
     , id(_id)
     , bounds()
     , centroid(0.0f)
-    , albedo(alb)
-    , emission(emi) {
+    , material(_material) {
+    updateBounds();
+}
+
+void bvhTri::updateBounds() {
+    bounds = AABB();
     bounds.expand(v0);
     bounds.expand(v1);
     bounds.expand(v2);
     centroid = bounds.centroid();
 }
 
-/*
 // Möller–Trumbore
 bool bvhTri::intersectTriangle(const Ray& r, const bvhTri& tri, float& t, float& u, float& v) {
     const float EPS = 1e-8f;
@@ -56,5 +57,4 @@ bool bvhTri::intersectTriangle(const Ray& r, const bvhTri& tri, float& t, float&
     if (v < 0.0f || (u + v) > 1.0f) return false;
     t = glm::dot(e2, q) * invDet;
     return t > r.tmin && t < r.tmax;
-}
-*/
\ No newline at end of file
+}
\ No newline at end of file
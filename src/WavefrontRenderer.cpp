@@ -0,0 +1,261 @@
+#include "WavefrontRenderer.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace {
+
+// std430 sizes and offsets of the structs in wavefront_common.glsl
+const size_t PathStateSize = 6 * 16;
+const size_t ShadowRaySize = 3 * 16;
+const size_t CounterBufferSize = 64;
+const GLintptr QueueCountOffset = 0;    // uint queueCount[2]
+const GLintptr ShadowCountOffset = 8;   // uint shadowCount
+const GLintptr QueueGroupsOffset = 16;  // DispatchArgs queueGroups[2]
+const GLintptr ShadowGroupsOffset = 48; // DispatchArgs shadowGroups
+
+const GLuint GroupSize = 64; // local_size_x of every kernel
+const GLuint MaxGroups = 65535; // MAX_GROUPS in wavefront_common.glsl, the guaranteed GL_MAX_COMPUTE_WORK_GROUP_COUNT
+
+const char* const StageFiles[] = {
+    "resources/shaders/wavefront_generate.comp",
+    "resources/shaders/wavefront_extend.comp",
+    "resources/shaders/wavefront_shade.comp",
+    "resources/shaders/wavefront_shadow.comp",
+    "resources/shaders/wavefront_accumulate.comp",
+};
+
+// an empty queue: no entries, zero groups of 1 x 1
+void ResetCounter(GLintptr countOffset, GLintptr groupsOffset)
+{
+    const uint32_t count = 0;
+    const uint32_t groups[4] = { 0, 1, 1, 0 };
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, countOffset, sizeof(count), &count);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, groupsOffset, sizeof(groups), groups);
+}
+
+} // namespace
+
+double WavefrontStageTimes::total() const
+{
+    double sum = 0.0;
+    for (double t : ms) sum += t;
+    return sum;
+}
+
+const char* WavefrontStageTimes::name(WavefrontStage stage)
+{
+    switch (stage) {
+    case WavefrontStage::Generate:   return "generate";
+    case WavefrontStage::Extend:     return "extend";
+    case WavefrontStage::Shade:      return "shade";
+    case WavefrontStage::Shadow:     return "shadow";
+    case WavefrontStage::Accumulate: return "accumulate";
+    default:                         return "";
+    }
+}
+
+WavefrontRenderer::WavefrontRenderer()
+    : m_PathBuffer(0), m_QueueBuffer(0), m_ShadowBuffer(0), m_CounterBuffer(0)
+    , m_PathCount(0), m_Timing(false), m_QueriesUsed(0) {}
+
+WavefrontRenderer::~WavefrontRenderer()
+{
+    release();
+    if (!m_Queries.empty())
+        glDeleteQueries(static_cast<GLsizei>(m_Queries.size()), m_Queries.data());
+}
+
+bool WavefrontRenderer::supported()
+{
+    return GLEW_VERSION_4_3 != 0;
+}
+
+bool WavefrontRenderer::init(const std::string& defines)
+{
+    for (int i = 0; i < static_cast<int>(WavefrontStage::Count); ++i) {
+        m_Stages[i].reset(new Shader(GL_COMPUTE_SHADER, StageFiles[i], defines));
+        if (!m_Stages[i]->IsValid())
+            return false;
+    }
+    return true;
+}
+
+void WavefrontRenderer::release()
+{
+    GLuint buffers[] = { m_PathBuffer, m_QueueBuffer, m_ShadowBuffer, m_CounterBuffer };
+    if (m_PathBuffer) glDeleteBuffers(4, buffers);
+    m_PathBuffer = m_QueueBuffer = m_ShadowBuffer = m_CounterBuffer = 0;
+    m_PathCount = 0;
+}
+
+void WavefrontRenderer::resize(int pathCount)
+{
+    if (pathCount == m_PathCount && m_PathBuffer)
+        return;
+    release();
+    m_PathCount = pathCount;
+
+    GLuint buffers[4];
+    glGenBuffers(4, buffers);
+    m_PathBuffer = buffers[0];
+    m_QueueBuffer = buffers[1];
+    m_ShadowBuffer = buffers[2];
+    m_CounterBuffer = buffers[3];
+    const size_t sizes[4] = {
+        pathCount * PathStateSize,
+        2 * pathCount * sizeof(uint32_t),
+        pathCount * ShadowRaySize,
+        CounterBufferSize,
+    };
+    for (int i = 0; i < 4; ++i) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(sizes[i]), nullptr, GL_DYNAMIC_DRAW);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void WavefrontRenderer::resetQueue(int queue)
+{
+    ResetCounter(QueueCountOffset + queue * 4, QueueGroupsOffset + queue * 16);
+}
+
+void WavefrontRenderer::resetShadowRays()
+{
+    ResetCounter(ShadowCountOffset, ShadowGroupsOffset);
+}
+
+void WavefrontRenderer::dispatch(WavefrontStage s, GLuint groups)
+{
+    beginTimer(s);
+    glDispatchCompute(groups, 1, 1);
+    endTimer();
+}
+
+void WavefrontRenderer::dispatchIndirect(WavefrontStage s, GLintptr offset)
+{
+    beginTimer(s);
+    glDispatchComputeIndirect(offset);
+    endTimer();
+}
+
+void WavefrontRenderer::render(const GPUScene& scene, AccumulationBuffer& accumulation, const glm::vec3& camPos,
+                               const glm::mat4& invViewProj, int width, int height, int spp, int maxDepth, int frame)
+{
+    resize(width * height);
+    m_QueriesUsed = 0;
+    // past MaxGroups the kernels loop over the remaining paths
+    const GLuint pathGroups = std::min((static_cast<GLuint>(m_PathCount) + GroupSize - 1) / GroupSize, MaxGroups);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_PathBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_QueueBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_ShadowBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_CounterBuffer);
+    // counter resets go through the generic binding, indirect dispatches read the same buffer
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_CounterBuffer);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_CounterBuffer);
+
+    // Uniforms that hold for the whole frame; scene textures stay on units 0-5 for every kernel
+    for (auto& s : m_Stages) {
+        s->BindShader();
+        s->SetUniform1i("uPathCount", m_PathCount);
+    }
+    Shader& generate = stage(WavefrontStage::Generate);
+    generate.BindShader();
+    scene.bind(generate);
+    generate.SetUniform3fv("uCamPos", camPos);
+    generate.SetUniformMat4fv("uInvViewProj", invViewProj);
+    generate.SetUniform2f("uResolution", static_cast<float>(width), static_cast<float>(height));
+    generate.SetUniform1i("uFrame", frame);
+    Shader& extend = stage(WavefrontStage::Extend);
+    extend.BindShader();
+    scene.bind(extend);
+    Shader& shade = stage(WavefrontStage::Shade);
+    shade.BindShader();
+    scene.bind(shade);
+    shade.SetUniform1i("uMaxDepth", maxDepth);
+    Shader& shadow = stage(WavefrontStage::Shadow);
+    shadow.BindShader();
+    scene.bind(shadow);
+
+    for (int s = 0; s < spp; ++s) {
+        resetQueue(0);
+        resetQueue(1);
+        resetShadowRays();
+        generate.BindShader();
+        generate.SetUniform1i("uSample", s);
+        dispatch(WavefrontStage::Generate, pathGroups);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+        for (int depth = 0; depth < maxDepth; ++depth) {
+            const int q = depth & 1;
+            extend.BindShader();
+            extend.SetUniform1i("uQueue", q);
+            dispatchIndirect(WavefrontStage::Extend, QueueGroupsOffset + q * 16);
+            // shade reads the hits, and appends to the other queue and the shadow rays, both emptied here
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+            resetQueue(1 - q);
+            resetShadowRays();
+
+            shade.BindShader();
+            shade.SetUniform1i("uQueue", q);
+            shade.SetUniform1i("uDepth", depth);
+            dispatchIndirect(WavefrontStage::Shade, QueueGroupsOffset + q * 16);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+            shadow.BindShader();
+            dispatchIndirect(WavefrontStage::Shadow, ShadowGroupsOffset);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+        }
+    }
+
+    Shader& accumulate = stage(WavefrontStage::Accumulate);
+    accumulate.BindShader();
+    accumulate.SetUniform1i("uSpp", spp);
+    accumulate.SetUniform1i("uWidth", width);
+    accumulation.beginComputeFrame(accumulate);
+    dispatch(WavefrontStage::Accumulate, pathGroups);
+    // the result is drawn, read back or the previous average of the next frame
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT |
+                    GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    accumulation.endFrame(spp);
+
+    accumulate.UnBindShader();
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    if (m_Timing)
+        collectTimes();
+}
+
+void WavefrontRenderer::beginTimer(WavefrontStage s)
+{
+    if (!m_Timing) return;
+    if (2 * m_QueriesUsed == m_Queries.size()) {
+        // grow the pool by the pairs of a typical frame at once
+        const size_t grow = 256;
+        m_Queries.resize(m_Queries.size() + 2 * grow);
+        glGenQueries(static_cast<GLsizei>(2 * grow), &m_Queries[m_Queries.size() - 2 * grow]);
+        m_QueryStages.resize(m_Queries.size() / 2);
+    }
+    m_QueryStages[m_QueriesUsed] = s;
+    glQueryCounter(m_Queries[2 * m_QueriesUsed], GL_TIMESTAMP);
+}
+
+void WavefrontRenderer::endTimer()
+{
+    if (!m_Timing) return;
+    glQueryCounter(m_Queries[2 * m_QueriesUsed + 1], GL_TIMESTAMP);
+    m_QueriesUsed++;
+}
+
+// waits for the frame's queries and sums them per stage
+void WavefrontRenderer::collectTimes()
+{
+    m_Times = WavefrontStageTimes();
+    for (size_t i = 0; i < m_QueriesUsed; ++i) {
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(m_Queries[2 * i], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(m_Queries[2 * i + 1], GL_QUERY_RESULT, &end);
+        m_Times.ms[static_cast<int>(m_QueryStages[i])] += static_cast<double>(end - begin) * 1e-6;
+    }
+}
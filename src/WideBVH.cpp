@@ -0,0 +1,372 @@
+#include "WideBVH.h"
+
+#include <immintrin.h>
+#include <limits>
+
+#include "TraversalStack.h"
+
+namespace {
+
+// ray data shared by every slab test of one traversal
+struct WideRay {
+    float ox, oy, oz;
+    float ix, iy, iz;        // 1 / direction
+    bool negX, negY, negZ;   // direction sign picks which plane of each slab is entered first
+};
+
+// planes the ray enters and leaves through, per axis
+struct SlabPlanes {
+    const float* nearX; const float* nearY; const float* nearZ;
+    const float* farX;  const float* farY;  const float* farZ;
+};
+
+template <int N>
+SlabPlanes slabPlanes(const WideBVHNode<N>& n, const WideRay& r) {
+    SlabPlanes p;
+    p.nearX = r.negX ? n.bmaxX : n.bminX; p.farX = r.negX ? n.bminX : n.bmaxX;
+    p.nearY = r.negY ? n.bmaxY : n.bminY; p.farY = r.negY ? n.bminY : n.bmaxY;
+    p.nearZ = r.negZ ? n.bmaxZ : n.bminZ; p.farZ = r.negZ ? n.bminZ : n.bmaxZ;
+    return p;
+}
+
+// Four children from lane `first` on. Returns a bit per child hit within [tmin, tmax] and writes the
+// entry distances. Every max/min takes the accumulated value second, so a NaN from a 0 * inf slab
+// leaves it unchanged. Loads are unaligned: std::vector does not honour over-aligned types before C++17.
+int slab4(const SlabPlanes& p, int first, const WideRay& r, float tmin, float tmax, float* tNear) {
+    const __m128 ox = _mm_set1_ps(r.ox), oy = _mm_set1_ps(r.oy), oz = _mm_set1_ps(r.oz);
+    const __m128 ix = _mm_set1_ps(r.ix), iy = _mm_set1_ps(r.iy), iz = _mm_set1_ps(r.iz);
+
+    __m128 tn = _mm_set1_ps(tmin);
+    __m128 tf = _mm_set1_ps(tmax);
+    tn = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(p.nearX + first), ox), ix), tn);
+    tn = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(p.nearY + first), oy), iy), tn);
+    tn = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(p.nearZ + first), oz), iz), tn);
+    tf = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(p.farX + first), ox), ix), tf);
+    tf = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(p.farY + first), oy), iy), tf);
+    tf = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(p.farZ + first), oz), iz), tf);
+
+    _mm_storeu_ps(tNear + first, tn);
+    return _mm_movemask_ps(_mm_cmple_ps(tn, tf));
+}
+
+#ifdef __AVX__
+int slab8(const SlabPlanes& p, const WideRay& r, float tmin, float tmax, float* tNear) {
+    const __m256 ox = _mm256_set1_ps(r.ox), oy = _mm256_set1_ps(r.oy), oz = _mm256_set1_ps(r.oz);
+    const __m256 ix = _mm256_set1_ps(r.ix), iy = _mm256_set1_ps(r.iy), iz = _mm256_set1_ps(r.iz);
+
+    __m256 tn = _mm256_set1_ps(tmin);
+    __m256 tf = _mm256_set1_ps(tmax);
+    tn = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(p.nearX), ox), ix), tn);
+    tn = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(p.nearY), oy), iy), tn);
+    tn = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(p.nearZ), oz), iz), tn);
+    tf = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(p.farX), ox), ix), tf);
+    tf = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(p.farY), oy), iy), tf);
+    tf = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(p.farZ), oz), iz), tf);
+
+    _mm256_storeu_ps(tNear, tn);
+    return _mm256_movemask_ps(_mm256_cmp_ps(tn, tf, _CMP_LE_OQ));
+}
+#endif
+
+// Möller–Trumbore of one ray against the four triangles of a group from lane `first` on, computed
+// exactly like bvhTri::intersectTriangle. Returns a bit per triangle hit within (tmin, tmax) and
+// writes t, u, v per lane.
+template <int N>
+int triangles4(const TriangleGroup<N>& g, int first, const Ray& r, float tmax, float* outT, float* outU, float* outV) {
+    const __m128 dx = _mm_set1_ps(r.d.x), dy = _mm_set1_ps(r.d.y), dz = _mm_set1_ps(r.d.z);
+    const __m128 e1x = _mm_loadu_ps(g.e1x + first), e1y = _mm_loadu_ps(g.e1y + first), e1z = _mm_loadu_ps(g.e1z + first);
+    const __m128 e2x = _mm_loadu_ps(g.e2x + first), e2y = _mm_loadu_ps(g.e2y + first), e2z = _mm_loadu_ps(g.e2z + first);
+
+    // p = cross(d, e2), det = dot(e1, p)
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(e2y, dz));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(e2z, dx));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(e2x, dy));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    __m128 mask = _mm_cmpge_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), det), _mm_set1_ps(1e-8f));
+    __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    // u = dot(o - v0, p) / det
+    __m128 tx = _mm_sub_ps(_mm_set1_ps(r.o.x), _mm_loadu_ps(g.v0x + first));
+    __m128 ty = _mm_sub_ps(_mm_set1_ps(r.o.y), _mm_loadu_ps(g.v0y + first));
+    __m128 tz = _mm_sub_ps(_mm_set1_ps(r.o.z), _mm_loadu_ps(g.v0z + first));
+    __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), invDet);
+    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(u, _mm_setzero_ps()), _mm_cmple_ps(u, _mm_set1_ps(1.0f))));
+
+    // q = cross(o - v0, e1), v = dot(d, q) / det, t = dot(e2, q) / det
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(e1y, tz));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(e1z, tx));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(e1x, ty));
+    __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(v, _mm_setzero_ps()), _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f))));
+    __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+    mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpgt_ps(t, _mm_set1_ps(r.tmin)), _mm_cmplt_ps(t, _mm_set1_ps(tmax))));
+
+    _mm_storeu_ps(outT + first, t);
+    _mm_storeu_ps(outU + first, u);
+    _mm_storeu_ps(outV + first, v);
+    return _mm_movemask_ps(mask);
+}
+
+#ifdef __AVX__
+int triangles8(const TriangleGroup<8>& g, const Ray& r, float tmax, float* outT, float* outU, float* outV) {
+    const __m256 dx = _mm256_set1_ps(r.d.x), dy = _mm256_set1_ps(r.d.y), dz = _mm256_set1_ps(r.d.z);
+    const __m256 e1x = _mm256_loadu_ps(g.e1x), e1y = _mm256_loadu_ps(g.e1y), e1z = _mm256_loadu_ps(g.e1z);
+    const __m256 e2x = _mm256_loadu_ps(g.e2x), e2y = _mm256_loadu_ps(g.e2y), e2z = _mm256_loadu_ps(g.e2z);
+
+    __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(e2y, dz));
+    __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(e2z, dx));
+    __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(e2x, dy));
+    __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    __m256 mask = _mm256_cmp_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), det), _mm256_set1_ps(1e-8f), _CMP_GE_OQ);
+    __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+    __m256 tx = _mm256_sub_ps(_mm256_set1_ps(r.o.x), _mm256_loadu_ps(g.v0x));
+    __m256 ty = _mm256_sub_ps(_mm256_set1_ps(r.o.y), _mm256_loadu_ps(g.v0y));
+    __m256 tz = _mm256_sub_ps(_mm256_set1_ps(r.o.z), _mm256_loadu_ps(g.v0z));
+    __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), invDet);
+    mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(u, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(u, _mm256_set1_ps(1.0f), _CMP_LE_OQ)));
+
+    __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(e1y, tz));
+    __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(e1z, tx));
+    __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(e1x, ty));
+    __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+    mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GE_OQ),
+                                             _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ)));
+    __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+    mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(r.tmin), _CMP_GT_OQ),
+                                             _mm256_cmp_ps(t, _mm256_set1_ps(tmax), _CMP_LT_OQ)));
+
+    _mm256_storeu_ps(outT, t);
+    _mm256_storeu_ps(outU, u);
+    _mm256_storeu_ps(outV, v);
+    return _mm256_movemask_ps(mask);
+}
+#endif
+
+int intersectTriangles(const TriangleGroup<4>& g, const Ray& r, float tmax, float* t, float* u, float* v) {
+    return triangles4(g, 0, r, tmax, t, u, v);
+}
+
+int intersectTriangles(const TriangleGroup<8>& g, const Ray& r, float tmax, float* t, float* u, float* v) {
+#ifdef __AVX__
+    return triangles8(g, r, tmax, t, u, v);
+#else
+    return triangles4(g, 0, r, tmax, t, u, v) | (triangles4(g, 4, r, tmax, t, u, v) << 4);
+#endif
+}
+
+int intersectChildren(const WideBVHNode<4>& n, const WideRay& r, float tmin, float tmax, float* tNear) {
+    return slab4(slabPlanes(n, r), 0, r, tmin, tmax, tNear);
+}
+
+int intersectChildren(const WideBVHNode<8>& n, const WideRay& r, float tmin, float tmax, float* tNear) {
+    SlabPlanes p = slabPlanes(n, r);
+#ifdef __AVX__
+    return slab8(p, r, tmin, tmax, tNear);
+#else
+    return slab4(p, 0, r, tmin, tmax, tNear) | (slab4(p, 4, r, tmin, tmax, tNear) << 4);
+#endif
+}
+
+} // namespace
+
+template <int N>
+WideBVH<N>::WideBVH()
+    : maxDepth(0) {}
+
+template <int N>
+void WideBVH<N>::build(const BVH& source) {
+    nodes.clear();
+    triangles.clear();
+    maxDepth = 0;
+    if (source.nodes.empty()) return;
+    nodes.reserve(source.nodes.size() / (N - 1) + 1);
+    triangles.reserve(source.primitives.size() / N + source.nodes.size() / 2 + 1);
+    collapse(source, 0, 0);
+}
+
+// Starts from the binary node's two children and keeps opening the interior child with the largest
+// surface area until N slots are used, then recurses into the remaining interior children.
+// A binary leaf at the root becomes a single leaf slot.
+template <int N>
+int WideBVH<N>::collapse(const BVH& source, int binaryNode, int depth) {
+    maxDepth = std::max(maxDepth, depth);
+    int slots[N];
+    int used = 0;
+    const BVHNode& b = source.nodes[binaryNode];
+    if (b.isLeaf()) {
+        slots[used++] = binaryNode;
+    } else {
+        slots[used++] = binaryNode + 1;
+        slots[used++] = b.offset;
+    }
+
+    while (used < N) {
+        int open = -1;
+        float bestArea = -1.0f;
+        for (int i = 0; i < used; ++i) {
+            const BVHNode& c = source.nodes[slots[i]];
+            if (c.isLeaf()) continue;
+            float area = c.bounds.surfaceArea();
+            if (area > bestArea) {
+                bestArea = area;
+                open = i;
+            }
+        }
+        if (open < 0) break;
+        int opened = slots[open];
+        slots[open] = opened + 1;
+        slots[used++] = source.nodes[opened].offset;
+    }
+
+    int nodeIndex = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+
+    const float inf = std::numeric_limits<float>::infinity();
+    for (int i = 0; i < N; ++i) {
+        WideBVHNode<N>& w = nodes[nodeIndex];
+        if (i >= used) {
+            w.bminX[i] = w.bminY[i] = w.bminZ[i] = inf;
+            w.bmaxX[i] = w.bmaxY[i] = w.bmaxZ[i] = -inf;
+            w.child[i] = 0;
+            w.count[i] = -1;
+            continue;
+        }
+
+        const BVHNode& c = source.nodes[slots[i]];
+        w.bminX[i] = c.bounds.bmin.x; w.bminY[i] = c.bounds.bmin.y; w.bminZ[i] = c.bounds.bmin.z;
+        w.bmaxX[i] = c.bounds.bmax.x; w.bmaxY[i] = c.bounds.bmax.y; w.bmaxZ[i] = c.bounds.bmax.z;
+        if (c.isLeaf()) {
+            w.child[i] = appendLeaf(source, c.offset, c.count);
+            w.count[i] = c.count;
+        } else {
+            // collapse() may grow the node array, so take the reference again afterwards
+            int child = collapse(source, slots[i], depth + 1);
+            nodes[nodeIndex].child[i] = child;
+            nodes[nodeIndex].count[i] = 0;
+        }
+    }
+    return nodeIndex;
+}
+
+// Packs primitives [first, first + count) of the source into groups of N; returns the first group
+template <int N>
+int WideBVH<N>::appendLeaf(const BVH& source, int first, int count) {
+    int firstGroup = static_cast<int>(triangles.size());
+    for (int k = 0; k < count; k += N) {
+        TriangleGroup<N> g;
+        for (int lane = 0; lane < N; ++lane) {
+            glm::vec3 v0(0.0f), e1(0.0f), e2(0.0f);
+            int prim = -1;
+            if (k + lane < count) {
+                prim = first + k + lane;
+                const bvhTri& t = source.primitives[prim];
+                v0 = t.v0;
+                e1 = t.v1 - t.v0;
+                e2 = t.v2 - t.v0;
+            }
+            g.v0x[lane] = v0.x; g.v0y[lane] = v0.y; g.v0z[lane] = v0.z;
+            g.e1x[lane] = e1.x; g.e1y[lane] = e1.y; g.e1z[lane] = e1.z;
+            g.e2x[lane] = e2.x; g.e2y[lane] = e2.y; g.e2z[lane] = e2.z;
+            g.prim[lane] = prim;
+        }
+        triangles.push_back(g);
+    }
+    return firstGroup;
+}
+
+template <int N>
+bool WideBVH<N>::intersectNearest(const Ray& r, float& out_t, int& out_triIdx, float& out_u, float& out_v) const {
+    if (nodes.empty()) return false;
+
+    WideRay wr;
+    wr.ox = r.o.x; wr.oy = r.o.y; wr.oz = r.o.z;
+    wr.ix = 1.0f / r.d.x; wr.iy = 1.0f / r.d.y; wr.iz = 1.0f / r.d.z;
+    wr.negX = wr.ix < 0.0f; wr.negY = wr.iy < 0.0f; wr.negZ = wr.iz < 0.0f;
+
+    struct Entry {
+        int node;
+        float t;
+    };
+    TraversalStack<Entry, 64 * (N - 1) + 1> stack(traversalStackSize());
+    int sp = 0;
+    stack[sp++] = { 0, r.tmin };
+
+    Ray ray = r;
+    bool hit = false;
+    int nearestTri = -1;
+    float hitu = 0.0f, hitv = 0.0f;
+    alignas(32) float tNear[N];
+    alignas(32) float triT[N], triU[N], triV[N];
+
+    while (sp > 0) {
+        Entry e = stack[--sp];
+        if (e.t > ray.tmax) continue;
+        const WideBVHNode<N>& node = nodes[e.node];
+
+        int mask = intersectChildren(node, wr, ray.tmin, ray.tmax, tNear);
+        int firstPush = sp;
+        for (int i = 0; i < N; ++i) {
+            if (!(mask & (1 << i))) continue;
+            if (node.count[i] > 0) {
+                int lastGroup = node.child[i] + (node.count[i] + N - 1) / N;
+                for (int g = node.child[i]; g < lastGroup; ++g) {
+                    int hits = intersectTriangles(triangles[g], ray, ray.tmax, triT, triU, triV);
+                    // lanes in primitive order with a strict test, so ties resolve like the scalar loop
+                    for (int lane = 0; hits; ++lane, hits >>= 1) {
+                        if (!(hits & 1) || triT[lane] >= ray.tmax) continue;
+                        ray.tmax = triT[lane]; nearestTri = triangles[g].prim[lane]; hit = true; hitu = triU[lane]; hitv = triV[lane];
+                    }
+                }
+            } else {
+                // insertion sort so the nearest child is popped first
+                int j = sp++;
+                while (j > firstPush && stack[j - 1].t < tNear[i]) {
+                    stack[j] = stack[j - 1];
+                    --j;
+                }
+                stack[j] = { node.child[i], tNear[i] };
+            }
+        }
+    }
+
+    if (hit) { out_t = ray.tmax; out_triIdx = nearestTri; out_u = hitu; out_v = hitv; }
+    return hit;
+}
+
+// Any-hit traversal: children in slot order, no distances kept, stops at the first triangle hit
+template <int N>
+bool WideBVH<N>::occluded(const Ray& r) const {
+    if (nodes.empty()) return false;
+
+    WideRay wr;
+    wr.ox = r.o.x; wr.oy = r.o.y; wr.oz = r.o.z;
+    wr.ix = 1.0f / r.d.x; wr.iy = 1.0f / r.d.y; wr.iz = 1.0f / r.d.z;
+    wr.negX = wr.ix < 0.0f; wr.negY = wr.iy < 0.0f; wr.negZ = wr.iz < 0.0f;
+
+    TraversalStack<int, 64 * (N - 1) + 1> stack(traversalStackSize());
+    int sp = 0;
+    stack[sp++] = 0;
+    alignas(32) float tNear[N];
+    alignas(32) float triT[N], triU[N], triV[N];
+
+    while (sp > 0) {
+        const WideBVHNode<N>& node = nodes[stack[--sp]];
+        int mask = intersectChildren(node, wr, r.tmin, r.tmax, tNear);
+        for (int i = 0; i < N; ++i) {
+            if (!(mask & (1 << i))) continue;
+            if (node.count[i] > 0) {
+                int lastGroup = node.child[i] + (node.count[i] + N - 1) / N;
+                for (int g = node.child[i]; g < lastGroup; ++g)
+                    if (intersectTriangles(triangles[g], r, r.tmax, triT, triU, triV))
+                        return true;
+            } else {
+                stack[sp++] = node.child[i];
+            }
+        }
+    }
+    return false;
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
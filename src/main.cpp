@@ -1,8 +1,15 @@
+#include <algorithm>
+#include <cctype>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <limits>
+#include <memory>
+#include <cmath>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
@@ -13,7 +20,15 @@
 #include "Model.h"
 #include "Triangle.h"
 #include "BVH.h"
+#include "Scene.h"
+#include "GPUScene.h"
+#include "BVHCache.h"
+#include "AccumulationBuffer.h"
 #include "Camera.h"
+#include "CpuRenderer.h"
+#include "ImageIO.h"
+#include "SceneFile.h"
+#include "WavefrontRenderer.h"
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
@@ -24,6 +39,9 @@ void processInput(GLFWwindow* window);
 const unsigned int SCR_WIDTH = 1400;
 const unsigned int SCR_HEIGHT = 1200;
 
+// built scene cache, reused by the windowed and headless paths
+const std::string cachePath = "resources/assets/CornellBox/CornellBox.bvhcache";
+
 // camera
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
 float lastX = SCR_WIDTH / 2.0f;
@@ -34,30 +52,587 @@ bool firstMouse = true;
 float deltaTime = 0.0f;	// time between current frame and last frame
 float lastFrame = 0.0f;
 
-static void GetModelTriangles(const Model& model, const glm::mat4& M, const glm::vec3& albedo, const glm::vec3& emission, std::vector<bvhTri>& outTris)
+// Object-space triangles of a model; placement in the world is left to scene instances
+static void GetModelTriangles(const Model& model, int material, std::vector<bvhTri>& outTris)
 {
 	for (const auto& mesh : model.meshes) {
 		const auto& verts = mesh.vertices;
 		const auto& idx = mesh.indices;
 		for (size_t i = 0; i + 2 < idx.size(); i += 3) {
-			const glm::vec3 p0 = glm::vec3(M * glm::vec4(verts[idx[i + 0]].Position, 1.0f));
-			const glm::vec3 p1 = glm::vec3(M * glm::vec4(verts[idx[i + 1]].Position, 1.0f));
-			const glm::vec3 p2 = glm::vec3(M * glm::vec4(verts[idx[i + 2]].Position, 1.0f));
-			bvhTri tri(p0, p1, p2, 0, albedo, emission);
+			const glm::vec3& p0 = verts[idx[i + 0]].Position;
+			const glm::vec3& p1 = verts[idx[i + 1]].Position;
+			const glm::vec3& p2 = verts[idx[i + 2]].Position;
+			bvhTri tri(p0, p1, p2, static_cast<int>(outTris.size()), material);
 			outTris.push_back(tri);
 		}
 	}
 }
 
-int main(void)
+static const char* SplitMethodName(BVHSplitMethod method)
+{
+	switch (method) {
+	case BVHSplitMethod::Median: return "median split";
+	case BVHSplitMethod::SAH:    return "binned SAH";
+	case BVHSplitMethod::Morton: return "linear BVH";
+	case BVHSplitMethod::SBVH:   return "split BVH";
+	}
+	return "";
+}
+
+// Adds a model as one bottom-level BVH of the given material; returns its geometry index
+static int AddModelGeometry(Scene& scene, const Model& model, int material, const BVHBuildSettings& settings)
+{
+	std::vector<bvhTri> tris;
+	tris.reserve(static_cast<size_t>(model.getTriangles()));
+	GetModelTriangles(model, material, tris);
+	return scene.addGeometry(std::move(tris), settings);
+}
+
+// Loads every model of a scene description and instances it once, geometry i for entry i.
+// Only the triangles are needed, so the meshes are not uploaded and no GL context is required.
+static void BuildScene(Scene& scene, const std::vector<SceneModelDesc>& models, const BVHBuildSettings& settings)
+{
+	for (const auto& desc : models) {
+		Model model(desc.path, false);
+		int material = scene.addMaterial(desc.albedo, desc.emission);
+		scene.addInstance(AddModelGeometry(scene, model, material, settings), desc.objectToWorld);
+	}
+	scene.buildTopLevel();
+}
+
+// Placement of the Cornell box models in the world
+static glm::mat4 CornellBoxTransform()
+{
+	glm::mat4 M(1.0f);
+	M = glm::translate(M, glm::vec3(138.0f, -136.0f, -350.0f));
+	M = glm::rotate(M, glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	M = glm::scale(M, glm::vec3(0.5f));
+	return M;
+}
+
+// Scene description: model file, albedo, emission, placement
+static std::vector<SceneModelDesc> CornellBoxModels(const glm::mat4& M)
+{
+	return {
+		{ "resources/assets/CornellBox/tallbox.obj",  glm::vec3(0.28f, 0.17f, 0.08f),   glm::vec3(0.0f), M },
+		{ "resources/assets/CornellBox/floor.obj",    glm::vec3(0.725f, 0.71f, 0.68f),  glm::vec3(0.0f), M },
+		{ "resources/assets/CornellBox/shortbox.obj", glm::vec3(0.28f, 0.17f, 0.08f),   glm::vec3(0.0f), M },
+		{ "resources/assets/CornellBox/left.obj",     glm::vec3(0.63f, 0.065f, 0.05f),  glm::vec3(0.0f), M },
+		{ "resources/assets/CornellBox/right.obj",    glm::vec3(0.14f, 0.45f, 0.091f),  glm::vec3(0.0f), M },
+		{ "resources/assets/CornellBox/light.obj",    glm::vec3(0.0f),                  glm::vec3(6.0f), M },
+	};
+}
+
+// Build one bottom-level BVH per model with its material, then instance each of them
+static BVHBuildSettings SceneBuildSettings()
+{
+	BVHBuildSettings bvhSettings;
+	bvhSettings.method = BVHSplitMethod::SAH;
+	bvhSettings.maxLeafSize = 8;
+	bvhSettings.treeletPasses = 3;
+	return bvhSettings;
+}
+
+// Restores the scene from the cache when it was written for the same files, materials, transforms
+// and settings, builds it otherwise, and prints a summary. Returns true on a cache hit; the cache
+// is then left open for uploading.
+static bool LoadScene(Scene& scene, BVHCache& cache, const std::string& cachePath, uint64_t cacheKey,
+	const std::vector<SceneModelDesc>& models, const BVHBuildSettings& settings)
+{
+	auto buildStart = std::chrono::high_resolution_clock::now();
+	bool cached = cache.open(cachePath, cacheKey);
+	if (cached)
+		cache.restore(scene);
+	else
+		BuildScene(scene, models, settings);
+	double buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - buildStart).count();
+
+	float sahCost = 0.0f;
+	size_t nodeCount = 0;
+	for (const auto& g : scene.geometries) {
+		sahCost += g.computeSAHCost();
+		nodeCount += g.nodes.size();
+	}
+	std::cout << "Scene: " << scene.triangleCount() << " unique triangles in " << scene.geometries.size() << " BVHs ("
+		<< nodeCount << " nodes, " << scene.referenceCount() << " leaf references, summed SAH cost " << sahCost
+		<< ", " << SplitMethodName(settings.method) << "), "
+		<< scene.instances.size() << " instances, " << (cached ? "loaded from cache" : "built") << " in " << buildMs << " ms" << std::endl;
+	return cached;
+}
+
+static glm::mat4 InverseViewProjection(Camera& cam, float aspect)
+{
+	glm::mat4 view = cam.GetViewMatrix();
+	glm::mat4 proj = glm::perspective(glm::radians(cam.Fov), aspect, 0.1f, 1000.0f);
+	return glm::inverse(proj * view);
+}
+
+// Command line. Without --output or --cpu the scene opens in the interactive window.
+struct CommandLine {
+	std::string scenePath;        // scene file (SceneFile.h); empty for the built-in Cornell box
+	std::string outputPath;       // .png, .exr, .pfm or .ppm
+	std::string statsPath;        // JSON render stats; defaults to the output path + ".json"
+	bool batch = false;           // render offscreen, write the image and exit
+	bool cpu = false;             // batch render with CpuRenderer instead of a hidden GL window
+	bool wavefront = false;       // trace with the compute shader kernels instead of the fragment shader
+	int width = SCR_WIDTH;
+	int height = SCR_HEIGHT;
+	int spp = 0;                  // target samples per pixel, 0 for no limit
+	double seconds = 0.0;         // wall-clock budget for the render, 0 for no limit
+	int maxDepth = 8;
+	int bvhStack = 64;            // traversal stack budget of the GPU shaders, GPUScene::maxStackSize
+	bool hasCamera = false;       // overrides the scene's camera
+	glm::vec3 cameraPosition = glm::vec3(0.0f);
+	float cameraYaw = YAW;
+	float cameraPitch = PITCH;
+	float cameraFov = FOV;
+};
+
+static void PrintUsage(const char* program)
+{
+	std::cout << "Usage: " << program << " [options]\n"
+		"  --scene FILE            scene file (default: built-in Cornell box)\n"
+		"  --output FILE           render offscreen and write FILE (.png, .exr, .pfm, .ppm)\n"
+		"  --cpu [FILE]            render offscreen with the CPU path tracer (default output render.ppm)\n"
+		"  --wavefront             trace with the wavefront compute kernels (OpenGL 4.3)\n"
+		"  --stats FILE            JSON render stats (default: output path + .json)\n"
+		"  --size WxH              resolution (default " << SCR_WIDTH << "x" << SCR_HEIGHT << ")\n"
+		"  --spp N                 stop after N samples per pixel\n"
+		"  --time SECONDS          stop after this much render time\n"
+		"  --depth N               max bounces (default 8)\n"
+		"  --bvh-stack N           GPU traversal stack budget; deeper BVHs trace stackless (default 64)\n"
+		"  --camera X,Y,Z[,YAW,PITCH[,FOV]]\n"
+		"                          camera position and angles in degrees\n"
+		"Without --spp or --time an offscreen render takes 20 samples per pixel." << std::endl;
+}
+
+static bool HasExtension(const std::string& path, const char* extension)
+{
+	size_t n = std::strlen(extension);
+	if (path.size() < n) return false;
+	for (size_t i = 0; i < n; ++i)
+		if (std::tolower(static_cast<unsigned char>(path[path.size() - n + i])) != extension[i])
+			return false;
+	return true;
+}
+
+static bool IsImagePath(const std::string& path)
+{
+	return HasExtension(path, ".png") || HasExtension(path, ".exr") || HasExtension(path, ".pfm") || HasExtension(path, ".ppm");
+}
+
+// Fills cmd from argv; prints the problem and returns false on a bad command line
+static bool ParseCommandLine(int argc, char** argv, CommandLine& cmd)
+{
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		const char* value = hasValue ? argv[i + 1] : "";
+		bool ok = true;
+		if (arg == "--cpu") {
+			cmd.batch = cmd.cpu = true;
+			// the output may follow directly, as in "--cpu render.ppm"
+			if (hasValue && value[0] != '-') { cmd.outputPath = value; ++i; }
+			continue;
+		} else if (arg == "--wavefront") {
+			cmd.wavefront = true;
+			continue;
+		} else if (arg == "--help" || arg == "-h") {
+			PrintUsage(argv[0]);
+			return false;
+		} else if (!hasValue) {
+			ok = false;
+		} else if (arg == "--scene") {
+			cmd.scenePath = value;
+		} else if (arg == "--output" || arg == "-o") {
+			cmd.outputPath = value;
+			cmd.batch = true;
+		} else if (arg == "--stats") {
+			cmd.statsPath = value;
+		} else if (arg == "--size") {
+			ok = std::sscanf(value, "%dx%d", &cmd.width, &cmd.height) == 2 && cmd.width > 0 && cmd.height > 0;
+		} else if (arg == "--spp") {
+			ok = std::sscanf(value, "%d", &cmd.spp) == 1 && cmd.spp > 0;
+		} else if (arg == "--time") {
+			ok = std::sscanf(value, "%lf", &cmd.seconds) == 1 && cmd.seconds > 0.0;
+		} else if (arg == "--depth") {
+			ok = std::sscanf(value, "%d", &cmd.maxDepth) == 1 && cmd.maxDepth > 0;
+		} else if (arg == "--bvh-stack") {
+			ok = std::sscanf(value, "%d", &cmd.bvhStack) == 1 && cmd.bvhStack >= 0;
+		} else if (arg == "--camera") {
+			int n = std::sscanf(value, "%f,%f,%f,%f,%f,%f", &cmd.cameraPosition.x, &cmd.cameraPosition.y, &cmd.cameraPosition.z,
+				&cmd.cameraYaw, &cmd.cameraPitch, &cmd.cameraFov);
+			ok = n == 3 || n >= 5;
+			cmd.hasCamera = true;
+		} else {
+			std::cerr << "Unknown option " << arg << std::endl;
+			PrintUsage(argv[0]);
+			return false;
+		}
+		if (!ok) {
+			std::cerr << "Bad value for " << arg << std::endl;
+			return false;
+		}
+		++i;
+	}
+
+	if (cmd.batch) {
+		if (cmd.outputPath.empty()) cmd.outputPath = "render.ppm";
+		if (!IsImagePath(cmd.outputPath)) {
+			std::cerr << "Output must be a .png, .exr, .pfm or .ppm file: " << cmd.outputPath << std::endl;
+			return false;
+		}
+		if (cmd.statsPath.empty()) cmd.statsPath = cmd.outputPath + ".json";
+		if (cmd.spp == 0 && cmd.seconds == 0.0) cmd.spp = 20;
+	}
+	return true;
+}
+
+// Models, default camera and cache file of the scene to render: the scene file, or the built-in Cornell box
+static bool LoadSceneDescription(const CommandLine& cmd, SceneFile& desc, std::string& cacheFile)
+{
+	if (cmd.scenePath.empty()) {
+		desc = SceneFile();
+		desc.models = CornellBoxModels(CornellBoxTransform());
+		cacheFile = cachePath;
+		return true;
+	}
+	cacheFile = cmd.scenePath + ".bvhcache";
+	return LoadSceneFile(cmd.scenePath, desc);
+}
+
+// Points the global camera as the command line, else the scene file, asks
+static void SetupCamera(const CommandLine& cmd, const SceneFile& desc)
+{
+	if (cmd.hasCamera) {
+		camera = Camera(cmd.cameraPosition, glm::vec3(0.0f, 1.0f, 0.0f), cmd.cameraYaw, cmd.cameraPitch);
+		camera.Fov = cmd.cameraFov;
+	} else if (desc.hasCamera) {
+		camera = Camera(desc.cameraPosition, glm::vec3(0.0f, 1.0f, 0.0f), desc.cameraYaw, desc.cameraPitch);
+		camera.Fov = desc.cameraFov;
+	}
+}
+
+// Uploads the scene for the path tracing shader, straight from the open cache on a hit; writes the
+// cache on a miss
+static void UploadScene(const Scene& scene, BVHCache& cache, bool cached, const std::string& cacheFile, uint64_t cacheKey, GPUScene& gpuScene)
+{
+	if (cached) {
+		cache.upload(scene, gpuScene);
+		cache.close();
+	} else {
+		gpuScene.upload(scene);
+		if (!BVHCache::save(cacheFile, cacheKey, scene, gpuScene))
+			std::cout << "Could not write BVH cache " << cacheFile << std::endl;
+	}
+}
+
+// One path tracing pass of spp samples per pixel, folded into the accumulation buffer
+static void TraceFrame(Shader& shader, const GPUScene& gpuScene, AccumulationBuffer& accumulation, GLuint fsVAO,
+	const glm::mat4& invVP, int width, int height, int spp, int maxDepth, int frame)
+{
+	shader.BindShader();
+
+	// Bind scene buffers to units 0-5
+	gpuScene.bind(shader);
+
+	// Camera uniforms
+	shader.SetUniform3fv("uCamPos", camera.Position);
+	shader.SetUniformMat4fv("uInvViewProj", invVP);
+
+	// Resolution and integrator params
+	shader.SetUniform2f("uResolution", static_cast<float>(width), static_cast<float>(height));
+	shader.SetUniform1i("uSpp", spp);
+	shader.SetUniform1i("uMaxDepth", maxDepth);
+	shader.SetUniform1i("uFrame", frame);
+
+	// Previous average on unit 6, this frame's average into the other target
+	accumulation.beginFrame(shader, 6);
+	glBindVertexArray(fsVAO);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+	accumulation.endFrame(spp);
+
+	shader.UnBindShader();
+}
+
+// What an offscreen render did, for the log and the stats file
+struct BatchStats {
+	int samples = 0;       // samples per pixel reached
+	int passes = 0;        // frames (GPU) or render() calls (CPU)
+	double renderMs = 0.0;
+	int threads = 0;       // CPU backend only
+	bool wavefront = false; // GPU backend ran the compute kernels
+	bool stackless = false; // GPU backend traced without a traversal stack
+	WavefrontStageTimes stageTimes; // summed over all frames, wavefront only
+};
+
+// true while another pass fits the target samples and the time budget; the first pass always runs
+static bool NextPass(const CommandLine& cmd, const BatchStats& stats, double elapsedSeconds, int maxSpp, int& passSpp)
+{
+	if (stats.passes > 0 && cmd.seconds > 0.0 && elapsedSeconds >= cmd.seconds) return false;
+	passSpp = maxSpp;
+	if (cmd.spp > 0) passSpp = std::min(passSpp, cmd.spp - stats.samples);
+	return passSpp > 0;
+}
+
+// Renders with the CPU path tracer. Under a time budget each pass takes one sample per pixel, so the
+// budget is overshot by one pass at most.
+static void RenderBatchCPU(const CommandLine& cmd, const Scene& scene, std::vector<glm::vec3>& radiance, BatchStats& stats)
+{
+	CpuRenderSettings settings;
+	settings.width = cmd.width;
+	settings.height = cmd.height;
+	settings.maxDepth = cmd.maxDepth;
+	glm::mat4 invVP = InverseViewProjection(camera, static_cast<float>(settings.width) / static_cast<float>(settings.height));
+
+	CpuRenderer renderer;
+	std::vector<glm::vec3> pass;
+	auto renderStart = std::chrono::high_resolution_clock::now();
+	double elapsed = 0.0;
+	const int maxSpp = cmd.seconds > 0.0 ? 1 : std::numeric_limits<int>::max();
+	while (NextPass(cmd, stats, elapsed, maxSpp, settings.spp)) {
+		settings.frame = stats.passes;
+		renderer.render(scene, camera.Position, invVP, settings, pass);
+		// running average weighted by samples, as the accumulation buffer does on the GPU
+		if (stats.passes == 0) {
+			radiance.swap(pass);
+		} else {
+			float w = static_cast<float>(settings.spp) / static_cast<float>(stats.samples + settings.spp);
+			for (size_t i = 0; i < radiance.size(); ++i)
+				radiance[i] += (pass[i] - radiance[i]) * w;
+		}
+		stats.samples += settings.spp;
+		stats.passes++;
+		elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - renderStart).count();
+	}
+	stats.renderMs = elapsed * 1000.0;
+	stats.threads = renderer.threadCount();
+
+	std::cout << "CPU render: " << settings.width << "x" << settings.height << ", " << stats.samples << " spp in "
+		<< stats.passes << " passes on " << stats.threads << " threads in " << stats.renderMs << " ms" << std::endl;
+	for (size_t i = 0; i < renderer.tileStats().size(); ++i) {
+		const TileWorkerStats& s = renderer.tileStats()[i];
+		std::cout << "  thread " << i << ", last pass: " << s.tiles << " tiles (" << s.stolen << " stolen), busy "
+			<< s.busyMs << " ms, idle " << s.idleMs << " ms" << std::endl;
+	}
+}
+
+// Compute kernels for --wavefront, or null to use the fragment shader when the context lacks GL 4.3
+// or a kernel fails to build
+static std::unique_ptr<WavefrontRenderer> CreateWavefrontRenderer(const CommandLine& cmd, const GPUScene& gpuScene)
+{
+	if (!cmd.wavefront)
+		return nullptr;
+	std::unique_ptr<WavefrontRenderer> renderer(new WavefrontRenderer());
+	if (!WavefrontRenderer::supported() || !renderer->init(gpuScene.shaderDefines())) {
+		std::cerr << "Wavefront path tracing needs OpenGL 4.3 compute shaders, using the fragment shader" << std::endl;
+		return nullptr;
+	}
+	return renderer;
+}
+
+// Renders with the path tracing shader (or the wavefront kernels) in a hidden window, 20 samples per
+// pixel per frame like the interactive view
+static bool RenderBatchGPU(const CommandLine& cmd, const Scene& scene, BVHCache& cache, bool cached, const std::string& cacheFile,
+	uint64_t cacheKey, std::vector<glm::vec3>& radiance, BatchStats& stats)
+{
+	if (!glfwInit())
+		return false;
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	GLFWwindow* window = glfwCreateWindow(cmd.width, cmd.height, "Easy Ray Tracing - yuzhm", nullptr, nullptr);
+	if (!window) {
+		glfwTerminate();
+		return false;
+	}
+	glfwMakeContextCurrent(window);
+	glewExperimental = GL_TRUE;
+	if (glewInit() != GLEW_OK) {
+		std::cerr << "GLEW init failed\n";
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		return false;
+	}
+
+	// GL objects go out of scope before the context does
+	{
+		GPUScene gpuScene;
+		gpuScene.useStorageBuffers = GPUScene::storageBuffersSupported();
+		gpuScene.maxStackSize = cmd.bvhStack;
+		UploadScene(scene, cache, cached, cacheFile, cacheKey, gpuScene);
+		stats.stackless = gpuScene.stackless();
+		Shader shader("resources/shaders/raytracing_vertex.glsl", "resources/shaders/raytracing_fragment.glsl", gpuScene.shaderDefines());
+		AccumulationBuffer accumulation;
+		accumulation.resize(cmd.width, cmd.height);
+		GLuint fsVAO = 0;
+		glGenVertexArrays(1, &fsVAO);
+		glDisable(GL_DEPTH_TEST);
+		glViewport(0, 0, cmd.width, cmd.height);
+		glm::mat4 invVP = InverseViewProjection(camera, static_cast<float>(cmd.width) / static_cast<float>(cmd.height));
+		std::unique_ptr<WavefrontRenderer> wavefront = CreateWavefrontRenderer(cmd, gpuScene);
+		if (wavefront) wavefront->setTiming(true);
+		stats.wavefront = wavefront != nullptr;
+
+		auto renderStart = std::chrono::high_resolution_clock::now();
+		double elapsed = 0.0;
+		int passSpp;
+		while (NextPass(cmd, stats, elapsed, 20, passSpp)) {
+			if (wavefront) {
+				wavefront->render(gpuScene, accumulation, camera.Position, invVP, cmd.width, cmd.height, passSpp, cmd.maxDepth, stats.passes);
+				for (int i = 0; i < static_cast<int>(WavefrontStage::Count); ++i)
+					stats.stageTimes.ms[i] += wavefront->stageTimes().ms[i];
+			} else {
+				TraceFrame(shader, gpuScene, accumulation, fsVAO, invVP, cmd.width, cmd.height, passSpp, cmd.maxDepth, stats.passes);
+			}
+			glFinish(); // time the work, not its submission
+			stats.samples += passSpp;
+			stats.passes++;
+			elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - renderStart).count();
+		}
+		stats.renderMs = elapsed * 1000.0;
+		accumulation.read(radiance);
+		glDeleteVertexArrays(1, &fsVAO);
+	}
+	glfwDestroyWindow(window);
+	glfwTerminate();
+
+	std::cout << "GPU render" << (stats.wavefront ? " (wavefront)" : "") << ": " << cmd.width << "x" << cmd.height << ", "
+		<< stats.samples << " spp in " << stats.passes << " frames in " << stats.renderMs << " ms" << std::endl;
+	if (stats.wavefront) {
+		for (int i = 0; i < static_cast<int>(WavefrontStage::Count); ++i)
+			std::cout << "  " << WavefrontStageTimes::name(static_cast<WavefrontStage>(i)) << ": " << stats.stageTimes.ms[i] << " ms" << std::endl;
+	}
+	return true;
+}
+
+// Writes linear radiance by the file's extension: .exr and .pfm keep it as is, .png and .ppm are tone mapped
+static bool WriteImage(const std::string& path, int width, int height, std::vector<glm::vec3> radiance)
+{
+	if (HasExtension(path, ".exr")) return WriteEXR(path, width, height, radiance);
+	if (HasExtension(path, ".pfm")) return WritePFM(path, width, height, radiance);
+	for (auto& c : radiance)
+		c = CpuRenderer::toneMap(c);
+	if (HasExtension(path, ".png")) return WritePNG(path, width, height, radiance);
+	return WritePPM(path, width, height, radiance);
+}
+
+static std::string JsonString(const std::string& s)
+{
+	std::string out = "\"";
+	for (char c : s) {
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		} else if (static_cast<unsigned char>(c) < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			out += escaped;
+		} else {
+			out += c;
+		}
+	}
+	return out + "\"";
+}
+
+static bool WriteStats(const CommandLine& cmd, const Scene& scene, double loadMs, const BatchStats& stats)
+{
+	std::ofstream out(cmd.statsPath);
+	if (!out) return false;
+	double seconds = stats.renderMs / 1000.0;
+	double samples = static_cast<double>(cmd.width) * cmd.height * stats.samples;
+	out << "{\n"
+		<< "  \"backend\": " << JsonString(cmd.cpu ? "cpu" : stats.wavefront ? "gpu-wavefront" : "gpu") << ",\n"
+		<< "  \"scene\": " << JsonString(cmd.scenePath.empty() ? "builtin:cornell-box" : cmd.scenePath) << ",\n"
+		<< "  \"output\": " << JsonString(cmd.outputPath) << ",\n"
+		<< "  \"width\": " << cmd.width << ",\n"
+		<< "  \"height\": " << cmd.height << ",\n"
+		<< "  \"maxDepth\": " << cmd.maxDepth << ",\n"
+		<< "  \"targetSpp\": " << cmd.spp << ",\n"
+		<< "  \"timeBudgetSeconds\": " << cmd.seconds << ",\n"
+		<< "  \"spp\": " << stats.samples << ",\n"
+		<< "  \"passes\": " << stats.passes << ",\n"
+		<< "  \"threads\": " << stats.threads << ",\n"
+		<< "  \"triangles\": " << scene.triangleCount() << ",\n"
+		<< "  \"instances\": " << scene.instances.size() << ",\n"
+		<< "  \"bvhMaxDepth\": " << scene.maxDepth() << ",\n"
+		<< "  \"sceneLoadMs\": " << loadMs << ",\n"
+		<< "  \"renderMs\": " << stats.renderMs << ",\n"
+		<< "  \"samplesPerSecond\": " << (seconds > 0.0 ? samples / seconds : 0.0);
+	if (!cmd.cpu)
+		out << ",\n  \"stackless\": " << (stats.stackless ? "true" : "false");
+	if (stats.wavefront) {
+		// GPU time per kernel over the whole render
+		out << ",\n  \"stageMs\": {";
+		for (int i = 0; i < static_cast<int>(WavefrontStage::Count); ++i)
+			out << (i ? ", " : " ") << JsonString(WavefrontStageTimes::name(static_cast<WavefrontStage>(i))) << ": " << stats.stageTimes.ms[i];
+		out << " }";
+	}
+	out << "\n}\n";
+	return static_cast<bool>(out);
+}
+
+// Offscreen render for batch use: loads the scene, renders to the target samples or time budget on
+// the chosen backend, then writes the image and the stats file. Returns the process exit code.
+static int RunBatch(const CommandLine& cmd)
 {
+	SceneFile desc;
+	std::string cacheFile;
+	if (!LoadSceneDescription(cmd, desc, cacheFile))
+		return -1;
+	SetupCamera(cmd, desc);
+
+	Scene scene;
+	BVHCache cache;
+	const BVHBuildSettings bvhSettings = SceneBuildSettings();
+	const uint64_t cacheKey = BVHCache::sceneKey(desc.models, bvhSettings);
+	auto loadStart = std::chrono::high_resolution_clock::now();
+	bool cached = LoadScene(scene, cache, cacheFile, cacheKey, desc.models, bvhSettings);
+	double loadMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - loadStart).count();
+
+	std::vector<glm::vec3> radiance;
+	BatchStats stats;
+	if (cmd.cpu) {
+		cache.close();
+		RenderBatchCPU(cmd, scene, radiance, stats);
+	} else if (!RenderBatchGPU(cmd, scene, cache, cached, cacheFile, cacheKey, radiance, stats)) {
+		std::cerr << "Could not create an OpenGL context; try --cpu" << std::endl;
+		return -1;
+	}
+
+	if (!WriteImage(cmd.outputPath, cmd.width, cmd.height, radiance)) {
+		std::cerr << "Could not write " << cmd.outputPath << std::endl;
+		return -1;
+	}
+	std::cout << "Wrote " << cmd.outputPath << std::endl;
+	if (!WriteStats(cmd, scene, loadMs, stats)) {
+		std::cerr << "Could not write " << cmd.statsPath << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	CommandLine cmd;
+	if (!ParseCommandLine(argc, argv, cmd))
+		return -1;
+	// --output or --cpu: render offscreen, write the image and exit
+	if (cmd.batch)
+		return RunBatch(cmd);
+
+	SceneFile sceneDesc;
+	std::string sceneCacheFile;
+	if (!LoadSceneDescription(cmd, sceneDesc, sceneCacheFile))
+		return -1;
+	SetupCamera(cmd, sceneDesc);
+
 	GLFWwindow* window;
 
 	/* Initialize the library */
 	if (!glfwInit())
 		return -1;
 	/* Create a windowed mode window and its OpenGL context */
-	window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Easy Ray Tracing - yuzhm", nullptr, nullptr);
+	window = glfwCreateWindow(cmd.width, cmd.height, "Easy Ray Tracing - yuzhm", nullptr, nullptr);
 	if (!window)
 	{
 		glfwTerminate();
@@ -83,193 +658,190 @@ int main(void)
 
 	glDisable(GL_DEPTH_TEST);
 
-	// create and compile the vertex shader and fragment shader
-	std::string vertexShaderSource = "resources/shaders/raytracing_vertex.glsl";
-	std::string fragmentShaderSource = "resources/shaders/raytracing_fragment.glsl";
-
-	Shader shader = Shader(vertexShaderSource, fragmentShaderSource);
-
-	// Fullscreen draw VAO
-	GLuint fsVAO = 0;
-	glGenVertexArrays(1, &fsVAO);
-
-	// Load models (geometry only)
-	Model tallbox("resources/assets/CornellBox/tallbox.obj");
-	Model floor("resources/assets/CornellBox/floor.obj");
-	Model shortbox("resources/assets/CornellBox/shortbox.obj");
-	Model left("resources/assets/CornellBox/left.obj");
-	Model right("resources/assets/CornellBox/right.obj");
-	Model light("resources/assets/CornellBox/light.obj");
-
-	// Apply same model transform as before to place the scene
-	glm::mat4 M(1.0f);
-	M = glm::translate(M, glm::vec3(138.0f, -136.0f, -350.0f));
-	M = glm::rotate(M, glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-	M = glm::scale(M, glm::vec3(0.5f));
-
-	// Build triangles with materials
-	std::vector<bvhTri> bvhTris;
-	bvhTris.reserve(static_cast<size_t>(tallbox.getTriangles() + floor.getTriangles() + shortbox.getTriangles() + left.getTriangles() + right.getTriangles() + light.getTriangles()));
-
-	GetModelTriangles(tallbox, M, glm::vec3(0.28f, 0.17f, 0.08f), glm::vec3(0.0f), bvhTris);
-	GetModelTriangles(floor, M, glm::vec3(0.725f, 0.71f, 0.68f), glm::vec3(0.0f), bvhTris);
-	GetModelTriangles(shortbox, M, glm::vec3(0.28f, 0.17f, 0.08f), glm::vec3(0.0f), bvhTris);
-	GetModelTriangles(left, M, glm::vec3(0.63f, 0.065f, 0.05f), glm::vec3(0.0f), bvhTris);
-	GetModelTriangles(right, M, glm::vec3(0.14f, 0.45f, 0.091f), glm::vec3(0.0f), bvhTris);
-	GetModelTriangles(light, M, glm::vec3(0.0f), glm::vec3(6.0f), bvhTris);
-
-	// Build BVH
-	BVH bvh;
-	bvh.build(bvhTris, 8);
-
-	// Pack triangles into a buffer in BVH primitive order: 5 vec4 per triangle
-	std::vector<Triangle> triangles;
-	triangles.reserve(bvh.primitives.size());
-
-	glm::vec3 sceneMin(std::numeric_limits<float>::infinity());
-	glm::vec3 sceneMax(-std::numeric_limits<float>::infinity());
-
-	for (const auto& t : bvh.primitives) {
-		glm::vec4 p0(t.v0, 1.0f);
-		glm::vec4 p1(t.v1, 1.0f);
-		glm::vec4 p2(t.v2, 1.0f);
-		glm::vec4 alb(t.albedo, 0.0f);
-		glm::vec4 emi(t.emission, 0.0f);
-		triangles.emplace_back(p0, p1, p2, alb, emi);
-		sceneMin = glm::min(sceneMin, t.bounds.bmin);
-		sceneMax = glm::max(sceneMax, t.bounds.bmax);
-	}
-
-	int triCount = static_cast<int>(triangles.size());
-
-	// Upload triangle TBO
-	GLuint triBuffer = 0;
-	glGenBuffers(1, &triBuffer);
-	glBindBuffer(GL_TEXTURE_BUFFER, triBuffer);
-	glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(triangles.size() * sizeof(Triangle)), triangles.data(), GL_STATIC_DRAW);
-	glBindBuffer(GL_TEXTURE_BUFFER, 0);
-
-	GLuint triTex = 0;
-	glGenTextures(1, &triTex);
-	glBindTexture(GL_TEXTURE_BUFFER, triTex);
-	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, triBuffer);
-	glBindTexture(GL_TEXTURE_BUFFER, 0);
-
-	// Pack BVH nodes into texels: 3 RGBA32F per node
-	std::vector<glm::vec4> nodeTexels;
-	nodeTexels.reserve(bvh.nodes.size() * 3);
-	for (const auto& n : bvh.nodes) {
-		nodeTexels.emplace_back(glm::vec4(n.bounds.bmin, static_cast<float>(n.left)));
-		nodeTexels.emplace_back(glm::vec4(n.bounds.bmax, static_cast<float>(n.right)));
-		nodeTexels.emplace_back(glm::vec4(static_cast<float>(n.start), static_cast<float>(n.count), 0.0f, 0.0f));
-	}
-
-	GLuint bvhBuffer = 0;
-	glGenBuffers(1, &bvhBuffer);
-	glBindBuffer(GL_TEXTURE_BUFFER, bvhBuffer);
-	glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(nodeTexels.size() * sizeof(glm::vec4)), nodeTexels.data(), GL_STATIC_DRAW);
-	glBindBuffer(GL_TEXTURE_BUFFER, 0);
-
-	GLuint bvhTex = 0;
-	glGenTextures(1, &bvhTex);
-	glBindTexture(GL_TEXTURE_BUFFER, bvhTex);
-	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, bvhBuffer);
-	glBindTexture(GL_TEXTURE_BUFFER, 0);
-
-	shader.UnBindShader();
-
-	int frame = 0;
-	const int spp = 20;     // samples per pixel
-	const int maxDepth = 8;  // max bounces
-
-	// FPS calculation variables
-	int framesThisSecond = 0;
-	double fps = 0.0;
-	auto lastFpsTime = std::chrono::high_resolution_clock::now();
-
-	/* Loop until the user closes the window */
-	while (!glfwWindowShouldClose(window))
+	// GL objects go out of scope before the context does
 	{
-		// per-frame time logic
-		//float currentFrame = static_cast<float>(glfwGetTime());
-		//deltaTime = currentFrame - lastFrame;
-		//lastFrame = currentFrame;
-
-		// input
-		//processInput(window);
-
-		// Resolution and matrices
-		int fbw, fbh;
-		glfwGetFramebufferSize(window, &fbw, &fbh);
-		float aspect = static_cast<float>(fbw) / static_cast<float>(fbh);
-		glm::mat4 view = camera.GetViewMatrix();
-		glm::mat4 proj = glm::perspective(glm::radians(camera.Fov), aspect, 0.1f, 1000.0f);
-		glm::mat4 invVP = glm::inverse(proj * view);
-
-		// Render fullscreen path tracing
-		glClear(GL_COLOR_BUFFER_BIT);
-
-		shader.BindShader();
-
-		// Bind triangle buffer texture to unit 0
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_BUFFER, triTex);
-		shader.SetUniform1i("uTriangles", 0);
-		shader.SetUniform1i("uTriangleCount", triCount);
-
-		// Bind BVH node buffer to unit 1
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_BUFFER, bvhTex);
-		shader.SetUniform1i("uBVHNodes", 1);
-
-		// Camera uniforms
-		shader.SetUniform3fv("uCamPos", camera.Position);
-		shader.SetUniformMat4fv("uInvViewProj", invVP);
-
-		// Scene AABB
-		shader.SetUniform3fv("uSceneMin", sceneMin);
-		shader.SetUniform3fv("uSceneMax", sceneMax);
-
-		// Resolution and integrator params
-		shader.SetUniform2f("uResolution", static_cast<float>(fbw), static_cast<float>(fbh));
-		shader.SetUniform1i("uSpp", spp);
-		shader.SetUniform1i("uMaxDepth", maxDepth);
-		shader.SetUniform1i("uFrame", frame);
-
-		glBindVertexArray(fsVAO);
-		glDrawArrays(GL_TRIANGLES, 0, 3);
-		glBindVertexArray(0);
-
-		shader.UnBindShader();
-
-		// FPS calculation
-		framesThisSecond++;
-		auto now = std::chrono::high_resolution_clock::now();
-		double elapsed = std::chrono::duration<double>(now - lastFpsTime).count();
-		if (elapsed >= 1.0) {
-			fps = framesThisSecond / elapsed;
-			char title[128];
-			snprintf(title, sizeof(title), "Easy Ray Tracing - yuzhm | SSP: %d | FPS: %d", spp, static_cast<int>(fps));
-			glfwSetWindowTitle(window, title);
-			framesThisSecond = 0;
-			lastFpsTime = now;
+		// create and compile the vertex shader and fragment shader
+		std::string vertexShaderSource = "resources/shaders/raytracing_vertex.glsl";
+		std::string fragmentShaderSource = "resources/shaders/raytracing_fragment.glsl";
+		std::string displayShaderSource = "resources/shaders/display_fragment.glsl";
+
+		// tone maps the accumulated radiance to the window
+		Shader displayShader = Shader(vertexShaderSource, displayShaderSource);
+
+		// Fullscreen draw VAO
+		GLuint fsVAO = 0;
+		glGenVertexArrays(1, &fsVAO);
+
+		// The short box demos below only apply to the built-in Cornell box
+		const bool builtinScene = cmd.scenePath.empty();
+		const glm::mat4 M = CornellBoxTransform();
+		const int shortboxGeometry = 2;
+		const int shortboxInstance = 2;
+
+		const BVHBuildSettings bvhSettings = SceneBuildSettings();
+
+		// A cache written for the same files, materials, transforms and settings skips loading and building
+		Scene scene;
+		uint64_t cacheKey = BVHCache::sceneKey(sceneDesc.models, bvhSettings);
+		BVHCache cache;
+		bool cached = LoadScene(scene, cache, sceneCacheFile, cacheKey, sceneDesc.models, bvhSettings);
+
+		// rest pose of the short box by triangle id, for the deformation demo below
+		std::vector<bvhTri> shortboxRest;
+		if (builtinScene) {
+			shortboxRest.resize(scene.geometries[shortboxGeometry].inputPrimitiveCount);
+			for (const auto& t : scene.geometries[shortboxGeometry].primitives)
+				shortboxRest[t.id] = t;
 		}
 
-		frame++;
-
-		/* Swap front and back buffers */
-		glfwSwapBuffers(window);
+		// Upload triangles, bottom-level nodes, top-level nodes and instances as storage buffers on GL 4.3,
+		// buffer textures otherwise
+		GPUScene gpuScene;
+		gpuScene.useStorageBuffers = GPUScene::storageBuffersSupported();
+		gpuScene.maxStackSize = cmd.bvhStack;
+		UploadScene(scene, cache, cached, sceneCacheFile, cacheKey, gpuScene);
+		if (gpuScene.stackless())
+			std::cout << "BVH depth " << scene.maxDepth() << " exceeds the traversal stack budget, tracing stackless" << std::endl;
+
+		// the tracing shaders are built for the way the scene is bound
+		std::string sceneDefines = gpuScene.shaderDefines();
+		std::unique_ptr<Shader> shader(new Shader(vertexShaderSource, fragmentShaderSource, sceneDefines));
+
+		// --wavefront: the compute kernels trace instead, with their GPU time printed every second.
+		// Reading the timer queries waits for the GPU, so only the first frame after each report is timed.
+		std::unique_ptr<WavefrontRenderer> wavefront = CreateWavefrontRenderer(cmd, gpuScene);
+		bool timeStages = true;
+
+		int frame = 0;
+		const int spp = 20;     // samples per pixel per frame
+		const int maxDepth = cmd.maxDepth;  // max bounces
+
+		// frames add their samples to a running average until the view or the scene changes
+		AccumulationBuffer accumulation;
+		glm::mat4 lastInvVP(0.0f);
+
+		// bob the short box up and down (moves its instance, only the top-level BVH is rebuilt)
+		const bool animateShortBox = false;
+		// squash the short box in place (refits its bottom-level BVH)
+		const bool deformShortBox = false;
+
+		// FPS calculation variables
+		int framesThisSecond = 0;
+		double fps = 0.0;
+		auto lastFpsTime = std::chrono::high_resolution_clock::now();
+
+		/* Loop until the user closes the window */
+		while (!glfwWindowShouldClose(window))
+		{
+			// per-frame time logic
+			//float currentFrame = static_cast<float>(glfwGetTime());
+			//deltaTime = currentFrame - lastFrame;
+			//lastFrame = currentFrame;
+
+			// input
+			//processInput(window);
+
+			// Resolution and matrices
+			int fbw, fbh;
+			glfwGetFramebufferSize(window, &fbw, &fbh);
+			float aspect = static_cast<float>(fbw) / static_cast<float>(fbh);
+			glm::mat4 invVP = InverseViewProjection(camera, aspect);
+
+			bool sceneChanged = false;
+			if (animateShortBox && builtinScene) {
+				glm::mat4 offset = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 10.0f * std::sin(static_cast<float>(glfwGetTime())), 0.0f));
+				scene.setTransform(shortboxInstance, offset * M);
+				scene.buildTopLevel();
+				gpuScene.uploadTopLevel(scene);
+				sceneChanged = true;
+			}
+			if (deformShortBox && builtinScene) {
+				float squash = 0.75f + 0.25f * std::sin(static_cast<float>(glfwGetTime()));
+				for (auto& t : scene.geometries[shortboxGeometry].primitives) {
+					const bvhTri& rest = shortboxRest[t.id];
+					t.v0 = rest.v0 * glm::vec3(1.0f, squash, 1.0f);
+					t.v1 = rest.v1 * glm::vec3(1.0f, squash, 1.0f);
+					t.v2 = rest.v2 * glm::vec3(1.0f, squash, 1.0f);
+				}
+				if (scene.refitGeometry(shortboxGeometry)) {
+					std::cout << "Short box BVH degraded too far after refit, rebuilt" << std::endl;
+					gpuScene.upload(scene);
+				} else {
+					gpuScene.uploadRefit(scene, shortboxGeometry);
+				}
+				scene.buildTopLevel();
+				gpuScene.uploadTopLevel(scene);
+				sceneChanged = true;
+			}
+
+			// a rebuilt tree can outgrow the traversal stack the shaders were built with
+			if (sceneChanged && gpuScene.shaderDefines() != sceneDefines) {
+				sceneDefines = gpuScene.shaderDefines();
+				shader.reset(new Shader(vertexShaderSource, fragmentShaderSource, sceneDefines));
+				if (wavefront && !wavefront->init(sceneDefines))
+					wavefront.reset();
+			}
+
+			// the average so far is only valid for the same size, view and scene
+			bool resized = accumulation.resize(fbw, fbh);
+			if (resized || sceneChanged || invVP != lastInvVP)
+				accumulation.reset();
+			lastInvVP = invVP;
+
+			// Render fullscreen path tracing
+			glClear(GL_COLOR_BUFFER_BIT);
+
+			if (wavefront) {
+				wavefront->setTiming(timeStages);
+				wavefront->render(gpuScene, accumulation, camera.Position, invVP, fbw, fbh, spp, maxDepth, frame);
+				if (timeStages) {
+					const WavefrontStageTimes& t = wavefront->stageTimes();
+					std::cout << "Wavefront frame: " << t.total() << " ms GPU";
+					for (int i = 0; i < static_cast<int>(WavefrontStage::Count); ++i)
+						std::cout << (i ? ", " : " (") << WavefrontStageTimes::name(static_cast<WavefrontStage>(i)) << " " << t.ms[i];
+					std::cout << ")" << std::endl;
+					timeStages = false;
+				}
+			} else {
+				TraceFrame(*shader, gpuScene, accumulation, fsVAO, invVP, fbw, fbh, spp, maxDepth, frame);
+			}
+
+			// Show the average so far
+			displayShader.BindShader();
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, accumulation.resultTexture());
+			displayShader.SetUniform1i("uAccum", 0);
+			glBindVertexArray(fsVAO);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+			glBindVertexArray(0);
+			displayShader.UnBindShader();
+
+			// FPS calculation
+			framesThisSecond++;
+			auto now = std::chrono::high_resolution_clock::now();
+			double elapsed = std::chrono::duration<double>(now - lastFpsTime).count();
+			if (elapsed >= 1.0) {
+				fps = framesThisSecond / elapsed;
+				char title[128];
+				snprintf(title, sizeof(title), "Easy Ray Tracing - yuzhm | SSP: %d | FPS: %d", accumulation.sampleCount(), static_cast<int>(fps));
+				glfwSetWindowTitle(window, title);
+				timeStages = true;
+				framesThisSecond = 0;
+				lastFpsTime = now;
+			}
+
+			frame++;
+
+			/* Swap front and back buffers */
+			glfwSwapBuffers(window);
+
+			/* Poll for and process events */
+			glfwPollEvents();
+		}
 
-		/* Poll for and process events */
-		glfwPollEvents();
+		if (fsVAO) glDeleteVertexArrays(1, &fsVAO);
 	}
 
-	if (bvhTex) glDeleteTextures(1, &bvhTex);
-	if (bvhBuffer) glDeleteBuffers(1, &bvhBuffer);
-	if (triTex) glDeleteTextures(1, &triTex);
-	if (triBuffer) glDeleteBuffers(1, &triBuffer);
-	if (fsVAO) glDeleteVertexArrays(1, &fsVAO);
-
 	glfwDestroyWindow(window);
 
 	glfwTerminate();